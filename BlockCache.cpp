@@ -0,0 +1,86 @@
+#include "BlockCache.h"
+
+
+/**
+    BlockCache
+*/
+BlockCache::BlockCache(uint32_t capacity)
+    : m_capacity( capacity ),
+      m_hits( 0 ),
+      m_misses( 0 )
+{
+}
+
+BlockCache::~BlockCache()
+{
+}
+
+std::shared_ptr<const ChannelBlock> BlockCache::find(DataSource source, time_t chunkTime)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<Key, Entries::iterator>::iterator it = m_index.find(Key(chunkTime, source));
+    if (it == m_index.end())
+    {
+        m_misses++;
+        return std::shared_ptr<const ChannelBlock>();
+    }
+
+    m_hits++;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return it->second->second;
+}
+
+void BlockCache::insert(DataSource source, time_t chunkTime, const std::shared_ptr<const ChannelBlock>& block)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_capacity == 0)
+        return;
+
+    Key key(chunkTime, source);
+    std::map<Key, Entries::iterator>::iterator it = m_index.find(key);
+    if (it != m_index.end())
+    {
+        it->second->second = block;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+
+    m_entries.push_front(std::make_pair(key, block));
+    m_index[key] = m_entries.begin();
+    if (m_entries.size() > m_capacity)
+    {
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+    }
+}
+
+void BlockCache::erase(time_t chunkTime)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<Key, Entries::iterator>::iterator it = m_index.lower_bound(Key(chunkTime, 0));
+    while (it != m_index.end() && it->first.first == chunkTime)
+    {
+        m_entries.erase(it->second);
+        it = m_index.erase(it);
+    }
+}
+
+void BlockCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_index.clear();
+}
+
+/// statistics
+uint64_t BlockCache::getHits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t BlockCache::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
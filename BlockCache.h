@@ -0,0 +1,46 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "Platform.h"
+#include "Defs.h"
+#include "ChannelBlock.h"
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/**
+    BlockCache
+    Recently decoded chunks (least recently used are dropped), so the repeated
+    reads of the same cold range are not decoded again
+*/
+class BlockCache
+{
+    private:
+        typedef std::pair<time_t, int>  Key;    // chunk time, DataSource
+        typedef std::list<std::pair<Key, std::shared_ptr<const ChannelBlock>>> Entries;
+
+        Entries                             m_entries;  // most recently used first
+        std::map<Key, Entries::iterator>    m_index;
+        uint32_t                            m_capacity;
+        uint64_t                            m_hits;
+        uint64_t                            m_misses;
+        mutable std::mutex                  m_mutex;
+
+    public:
+        explicit BlockCache(uint32_t capacity);
+        ~BlockCache();
+
+        /// decoded chunk or NULL
+        std::shared_ptr<const ChannelBlock> find(DataSource source, time_t chunkTime);
+        void        insert(DataSource source, time_t chunkTime, const std::shared_ptr<const ChannelBlock>& block);
+        /// the chunk was rewritten or deleted
+        void        erase(time_t chunkTime);
+        void        clear();
+
+        /// statistics
+        uint64_t    getHits() const;
+        uint64_t    getMisses() const;
+};
+
+#endif // BLOCK_CACHE_H
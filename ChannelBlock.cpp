@@ -0,0 +1,295 @@
+#include "ChannelBlock.h"
+#include "Codec.h"
+#include <algorithm>
+#include <cstring>
+
+/// encoded block format
+static const uint8_t blockVersion = 2;
+static const uint8_t blockVersionPlainInts = 1;   // mediaLossRate and rate as plain varints
+static const uint8_t blockFlagInput = 0x01;
+static const uint8_t blockFlagHalfPcr = 0x02;
+
+
+/// sections are prefixed by their length: the section is encoded in place,
+/// then its length is inserted before it (no temporary buffers)
+static size_t beginSection(const std::vector<uint8_t>& out)
+{
+    return out.size();
+}
+
+static void endSection(std::vector<uint8_t>& out, size_t start)
+{
+    uint8_t length[10];
+    uint32_t bytes = 0;
+    uint64_t value = out.size() - start;
+    do
+    {
+        length[bytes++] = static_cast<uint8_t>((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+    out.insert(out.begin() + start, length, length + bytes);
+}
+
+static bool getSection(const uint8_t*& p, const uint8_t* end, const uint8_t*& section, uint32_t& size)
+{
+    uint64_t length;
+    if (!Codec::getVarint(p, end, length) || length > static_cast<uint64_t>(end - p))
+        return false;
+    section = p;
+    size = static_cast<uint32_t>(length);
+    p += length;
+    return true;
+}
+
+/// version 1 blocks
+static bool decodeInts(const uint8_t* data, uint32_t size, std::vector<uint32_t>& values, uint32_t count)
+{
+    const uint8_t* end = data + size;
+    values.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t value;
+        if (!Codec::getVarint(data, end, value))
+            return false;
+        values[i] = static_cast<uint32_t>(value);
+    }
+    return true;
+}
+
+
+/**
+    ChannelBlock
+*/
+ChannelBlock::ChannelBlock(bool isInput)
+    : input( isInput )
+{
+}
+
+/// content
+void ChannelBlock::clear()
+{
+    time.clear();
+    delayFactor.clear();
+    mediaLossRate.clear();
+    rate.clear();
+    pcrSamples.clear();
+    pcr.clear();
+    pcrOffsets.clear();
+}
+
+void ChannelBlock::reserve(uint32_t count)
+{
+    time.reserve(count);
+    delayFactor.reserve(count);
+    if (input)
+        mediaLossRate.reserve(count);
+    rate.reserve(count);
+    pcrSamples.reserve(count);
+    pcrOffsets.reserve(count);
+    pcr.reserve(count * 2);
+}
+
+uint32_t ChannelBlock::size() const
+{
+    return static_cast<uint32_t>(time.size());
+}
+
+bool ChannelBlock::empty() const
+{
+    return time.empty();
+}
+
+/// add the sample of the next second
+void ChannelBlock::append(int64_t sampleTime, const InputData& in)
+{
+    uint8_t samples = std::min<uint8_t>(in.samples, maxSamples);
+    time.push_back(sampleTime);
+    delayFactor.push_back(in.delayFactor);
+    mediaLossRate.push_back(in.mediaLossRate);
+    rate.push_back(in.rate);
+    pcrSamples.push_back(samples);
+    pcrOffsets.push_back(static_cast<uint32_t>(pcr.size()));
+    pcr.insert(pcr.end(), in.pcrArray, in.pcrArray + samples);
+}
+
+void ChannelBlock::append(int64_t sampleTime, const OutputData& out)
+{
+    uint8_t samples = std::min<uint8_t>(out.samples, maxSamples);
+    time.push_back(sampleTime);
+    delayFactor.push_back(out.delayFactor);
+    rate.push_back(out.rate);
+    pcrSamples.push_back(samples);
+    pcrOffsets.push_back(static_cast<uint32_t>(pcr.size()));
+    pcr.insert(pcr.end(), out.pcrArray, out.pcrArray + samples);
+}
+
+/// copy the samples out
+void ChannelBlock::get(uint32_t index, InputData& in, uint32_t& pcrOffset) const
+{
+    in.delayFactor = delayFactor[index];
+    in.mediaLossRate = mediaLossRate.empty() ? 0 : mediaLossRate[index];
+    in.rate = rate[index];
+    in.samples = pcrSamples[index];
+    if (in.samples)
+        memcpy(in.pcrArray, &pcr[pcrOffset], sizeof(float) * in.samples);
+    pcrOffset += in.samples;
+}
+
+void ChannelBlock::get(uint32_t index, OutputData& out, uint32_t& pcrOffset) const
+{
+    out.delayFactor = delayFactor[index];
+    out.rate = rate[index];
+    out.samples = pcrSamples[index];
+    if (out.samples)
+        memcpy(out.pcrArray, &pcr[pcrOffset], sizeof(float) * out.samples);
+    pcrOffset += out.samples;
+}
+
+uint32_t ChannelBlock::getPcrOffset(uint32_t index) const
+{
+    return index < size() ? pcrOffsets[index] : static_cast<uint32_t>(pcr.size());
+}
+
+void ChannelBlock::getPcr(uint32_t index, uint32_t count, std::vector<float>& values,
+                          std::vector<uint32_t>& offsets) const
+{
+    uint32_t first = getPcrOffset(index);
+    uint32_t last = getPcrOffset(index + count);
+    uint32_t base = static_cast<uint32_t>(values.size());
+    for (uint32_t i = index; i < index + count; i++)
+        offsets.push_back(base + pcrOffsets[i] - first);
+    values.insert(values.end(), pcr.begin() + first, pcr.begin() + last);
+}
+
+uint32_t ChannelBlock::findTime(int64_t sampleTime) const
+{
+    return static_cast<uint32_t>(std::lower_bound(time.begin(), time.end(), sampleTime) - time.begin());
+}
+
+void ChannelBlock::summarize(BlockSummary& summary) const
+{
+    summary.minDelayFactor = summary.maxDelayFactor = delayFactor[0];
+    summary.minRate = summary.maxRate = rate[0];
+    for (uint32_t i = 1; i < size(); i++)
+    {
+        summary.minDelayFactor = std::min(summary.minDelayFactor, delayFactor[i]);
+        summary.maxDelayFactor = std::max(summary.maxDelayFactor, delayFactor[i]);
+        summary.minRate = std::min(summary.minRate, rate[i]);
+        summary.maxRate = std::max(summary.maxRate, rate[i]);
+    }
+
+    summary.maxMediaLossRate = 0;
+    summary.sumMediaLossRate = 0;
+    summary.lossSeconds = 0;
+    for (size_t i = 0; i < mediaLossRate.size(); i++)
+    {
+        summary.maxMediaLossRate = std::max(summary.maxMediaLossRate, mediaLossRate[i]);
+        summary.sumMediaLossRate += mediaLossRate[i];
+        summary.lossSeconds += (mediaLossRate[i] != 0);
+    }
+}
+
+/// serialization
+// version, flags, then the sections: time, delayFactor, [mediaLossRate], rate, pcrSamples, pcr
+void ChannelBlock::encode(std::vector<uint8_t>& out, bool halfPcr) const
+{
+    uint32_t count = size();
+    size_t section;
+
+    out.push_back(blockVersion);
+    out.push_back((input ? blockFlagInput : 0) | (halfPcr ? blockFlagHalfPcr : 0));
+
+    section = beginSection(out);
+    Codec::encodeTimes(count ? &time[0] : NULL, count, out);
+    endSection(out, section);
+
+    section = beginSection(out);
+    Codec::encodeFloats(count ? &delayFactor[0] : NULL, count, out);
+    endSection(out, section);
+
+    if (input)
+    {
+        section = beginSection(out);
+        Codec::encodeSparse(count ? &mediaLossRate[0] : NULL, count, out);
+        endSection(out, section);
+    }
+
+    section = beginSection(out);
+    Codec::encodeDeltas(count ? &rate[0] : NULL, count, out);
+    endSection(out, section);
+
+    section = beginSection(out);
+    out.insert(out.end(), pcrSamples.begin(), pcrSamples.end());
+    endSection(out, section);
+
+    section = beginSection(out);
+    if (halfPcr)
+        Codec::encodeHalfs(pcr.empty() ? NULL : &pcr[0], static_cast<uint32_t>(pcr.size()), out);
+    else
+        Codec::encodeFloats(pcr.empty() ? NULL : &pcr[0], static_cast<uint32_t>(pcr.size()), out);
+    endSection(out, section);
+}
+
+bool ChannelBlock::decode(const uint8_t* data, uint32_t size)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    const uint8_t* section;
+    uint32_t sectionSize;
+
+    clear();
+    if (size < 2 || (p[0] != blockVersion && p[0] != blockVersionPlainInts))
+        return false;
+    bool plainInts = (p[0] == blockVersionPlainInts);
+    input = (p[1] & blockFlagInput) != 0;
+    bool halfPcr = (p[1] & blockFlagHalfPcr) != 0;
+    p += 2;
+
+    TimeIndex timeIndex;
+    if (!getSection(p, end, section, sectionSize) || !timeIndex.parse(section, sectionSize))
+        return false;
+    uint32_t count = timeIndex.getCount();
+    time.resize(count);
+    if (count)
+        timeIndex.decode(&time[0]);
+
+    delayFactor.resize(count);
+    if (!getSection(p, end, section, sectionSize) ||
+        !Codec::decodeFloats(section, sectionSize, count ? &delayFactor[0] : NULL, count))
+        return false;
+
+    if (input)
+    {
+        mediaLossRate.resize(count);
+        if (!getSection(p, end, section, sectionSize) ||
+            !(plainInts ? decodeInts(section, sectionSize, mediaLossRate, count) :
+                          Codec::decodeSparse(section, sectionSize, count ? &mediaLossRate[0] : NULL, count)))
+            return false;
+    }
+
+    rate.resize(count);
+    if (!getSection(p, end, section, sectionSize) ||
+        !(plainInts ? decodeInts(section, sectionSize, rate, count) :
+                      Codec::decodeDeltas(section, sectionSize, count ? &rate[0] : NULL, count)))
+        return false;
+
+    if (!getSection(p, end, section, sectionSize) || sectionSize != count)
+        return false;
+    pcrSamples.assign(section, section + sectionSize);
+
+    uint32_t pcrCount = 0;
+    pcrOffsets.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        pcrOffsets[i] = pcrCount;
+        pcrCount += pcrSamples[i];
+    }
+    pcr.resize(pcrCount);
+    if (!getSection(p, end, section, sectionSize))
+        return false;
+    if (halfPcr ? !Codec::decodeHalfs(section, sectionSize, pcrCount ? &pcr[0] : NULL, pcrCount) :
+                  !Codec::decodeFloats(section, sectionSize, pcrCount ? &pcr[0] : NULL, pcrCount))
+        return false;
+
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef CHANNEL_BLOCK_H
+#define CHANNEL_BLOCK_H
+
+#include "Platform.h"
+#include "Defs.h"
+#include <vector>
+
+/**
+    BlockSummary
+    Zone map of a block: the queries skip the blocks that cannot match
+*/
+struct BlockSummary
+{
+    float       minDelayFactor;
+    float       maxDelayFactor;
+    uint32_t    minRate;
+    uint32_t    maxRate;
+    uint32_t    maxMediaLossRate;
+    uint64_t    sumMediaLossRate;
+    uint32_t    lossSeconds;        // seconds with mediaLossRate > 0
+};
+
+/**
+    ChannelBlock
+    Samples of one channel (DataSource) for a range of time, kept by columns.
+    The encoded form is what the chunk tables store: timestamps with the
+    TimeIndex encoding, floats with the XOR codec, rate as deltas from the
+    block reference value, mediaLossRate as a sparse list
+*/
+struct ChannelBlock
+{
+    std::vector<int64_t>    time;
+    std::vector<float>      delayFactor;
+    std::vector<uint32_t>   mediaLossRate;  // inputs only
+    std::vector<uint32_t>   rate;
+    std::vector<uint8_t>    pcrSamples;     // number of PCR values per second
+    std::vector<float>      pcr;            // PCR values of all seconds
+    std::vector<uint32_t>   pcrOffsets;     // position of the first PCR value of each second
+    bool                    input;
+
+    explicit ChannelBlock(bool isInput = true);
+
+    /// content
+    void        clear();
+    void        reserve(uint32_t count);
+    uint32_t    size() const;
+    bool        empty() const;
+
+    /// add the sample of the next second
+    void        append(int64_t sampleTime, const InputData& in);
+    void        append(int64_t sampleTime, const OutputData& out);
+
+    /// copy the sample out, pcrOffset is the position of its first PCR value
+    /// (see getPcrOffset) and is moved to the next sample
+    void        get(uint32_t index, InputData& in, uint32_t& pcrOffset) const;
+    void        get(uint32_t index, OutputData& out, uint32_t& pcrOffset) const;
+    uint32_t    getPcrOffset(uint32_t index) const;
+    /// append the PCR values of count seconds from index (one copy),
+    /// offsets get the position of the first value of each second in values
+    void        getPcr(uint32_t index, uint32_t count, std::vector<float>& values,
+                       std::vector<uint32_t>& offsets) const;
+
+    /// index of the first sample with time >= given one (size() if none)
+    uint32_t    findTime(int64_t sampleTime) const;
+
+    /// zone map of the content (the block is not empty)
+    void        summarize(BlockSummary& summary) const;
+
+    /// serialization, halfPcr stores PCR values with half precision
+    void        encode(std::vector<uint8_t>& out, bool halfPcr = false) const;
+    bool        decode(const uint8_t* data, uint32_t size);
+};
+
+#endif // CHANNEL_BLOCK_H
@@ -0,0 +1,611 @@
+#include "Codec.h"
+#include <cstring>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+
+/// bit helpers (x != 0)
+static inline uint32_t countLeadingZeros(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return 31 - index;
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+static inline uint32_t countTrailingZeros(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline uint32_t floatToBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float bitsToFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+/**
+    BitWriter
+*/
+BitWriter::BitWriter(std::vector<uint8_t>& out)
+    : m_out( out )
+    , m_acc( 0 )
+    , m_bits( 0 )
+{
+}
+BitWriter::~BitWriter()
+{
+}
+
+void BitWriter::flush()
+{
+    if (m_bits > 0)
+        write(0, 8 - m_bits);
+}
+
+
+/**
+    BitReader
+*/
+BitReader::BitReader(const uint8_t* data, uint32_t size)
+    : m_data( data )
+    , m_end( data + size )
+    , m_acc( 0 )
+    , m_bits( 0 )
+    , m_overrun( false )
+{
+}
+BitReader::~BitReader()
+{
+}
+
+
+/// time encoding modes
+enum TimeMode
+{
+    TIME_DENSE = 0,
+    TIME_DOD = 1
+};
+
+/// use the gap list while gaps are rare
+static const uint32_t maxGapRatio = 4; // at most one gap per 4 samples
+
+
+/**
+    TimeIndex
+*/
+TimeIndex::TimeIndex()
+    : m_base( 0 )
+    , m_count( 0 )
+    , m_dense( true )
+{
+}
+TimeIndex::~TimeIndex()
+{
+}
+
+// count, zigzag base time, mode byte, then
+//   dense: gap count, (index delta, extra seconds) per gap
+//   dod:   bit stream of the delta-of-delta values, the delta before the first sample is 1
+uint32_t TimeIndex::parse(const uint8_t* data, uint32_t size)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint64_t value;
+
+    m_gaps.clear();
+    m_times.clear();
+    if (!Codec::getVarint(p, end, value))
+        return 0;
+    m_count = static_cast<uint32_t>(value);
+    if (!Codec::getVarint(p, end, value) || p == end)
+        return 0;
+    m_base = Codec::zigzagDecode(value);
+    m_dense = (*p++ == TIME_DENSE);
+
+    if (m_dense)
+    {
+        uint64_t gapCount;
+        if (!Codec::getVarint(p, end, gapCount))
+            return 0;
+        m_gaps.resize(static_cast<size_t>(gapCount));
+        uint32_t index = 0;
+        int64_t offset = 0;
+        for (size_t i = 0; i < m_gaps.size(); i++)
+        {
+            uint64_t indexDelta, extra;
+            if (!Codec::getVarint(p, end, indexDelta) || !Codec::getVarint(p, end, extra))
+                return 0;
+            index += static_cast<uint32_t>(indexDelta);
+            offset += static_cast<int64_t>(extra);
+            m_gaps[i].index = index;
+            m_gaps[i].offset = offset;
+        }
+        return static_cast<uint32_t>(p - data);
+    }
+
+    BitReader reader(p, static_cast<uint32_t>(end - p));
+    m_times.resize(m_count);
+    int64_t time = m_base;
+    int64_t delta = 1;
+    for (uint32_t i = 0; i < m_count; i++)
+    {
+        if (i > 0)
+        {
+            int64_t dod = 0;
+            if (reader.read(1))
+            {
+                if (!reader.read(1))
+                    dod = static_cast<int64_t>(reader.read(7)) - 63;
+                else if (!reader.read(1))
+                    dod = static_cast<int64_t>(reader.read(9)) - 255;
+                else if (!reader.read(1))
+                    dod = static_cast<int64_t>(reader.read(12)) - 2047;
+                else
+                    dod = static_cast<int64_t>(static_cast<int32_t>(reader.read(32)));
+            }
+            delta += dod;
+            time += delta;
+        }
+        m_times[i] = time;
+    }
+    if (reader.isOverrun())
+        return 0;
+    return static_cast<uint32_t>(reader.getPosition() - data);
+}
+
+/// access
+uint32_t TimeIndex::getCount() const
+{
+    return m_count;
+}
+
+bool TimeIndex::isDense() const
+{
+    return m_dense;
+}
+
+int64_t TimeIndex::getTime(uint32_t index) const
+{
+    if (!m_dense)
+        return m_times[index];
+
+    // extra seconds of the last gap at or before the index
+    size_t lo = 0, hi = m_gaps.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_gaps[mid].index <= index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int64_t offset = (lo > 0) ? m_gaps[lo - 1].offset : 0;
+    return m_base + index + offset;
+}
+
+uint32_t TimeIndex::findTime(int64_t time) const
+{
+    // timestamps are increasing in both modes
+    uint32_t lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (getTime(mid) < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void TimeIndex::decode(int64_t* times) const
+{
+    if (!m_dense)
+    {
+        if (m_count)
+            memcpy(times, &m_times[0], m_count * sizeof(int64_t));
+        return;
+    }
+
+    size_t gap = 0;
+    int64_t offset = 0;
+    for (uint32_t i = 0; i < m_count; i++)
+    {
+        if (gap < m_gaps.size() && m_gaps[gap].index == i)
+            offset = m_gaps[gap++].offset;
+        times[i] = m_base + i + offset;
+    }
+}
+
+
+/**
+    Codec
+*/
+void Codec::putVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool Codec::getVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; data < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+void Codec::encodeTimes(const int64_t* times, uint32_t count, std::vector<uint8_t>& out)
+{
+    putVarint(out, count);
+    putVarint(out, zigzagEncode(count ? times[0] : 0));
+
+    // dense while the time only goes forward and the gaps are rare
+    uint32_t gapCount = 0;
+    bool increasing = true;
+    for (uint32_t i = 1; i < count && increasing; i++)
+    {
+        increasing = (times[i] > times[i - 1]);
+        if (times[i] != times[i - 1] + 1)
+            gapCount++;
+    }
+
+    if (increasing && gapCount <= count / maxGapRatio)
+    {
+        out.push_back(TIME_DENSE);
+        putVarint(out, gapCount);
+        uint32_t lastIndex = 0;
+        for (uint32_t i = 1; i < count; i++)
+        {
+            if (times[i] == times[i - 1] + 1)
+                continue;
+            putVarint(out, i - lastIndex);
+            putVarint(out, static_cast<uint64_t>(times[i] - times[i - 1] - 1));
+            lastIndex = i;
+        }
+        return;
+    }
+
+    out.push_back(TIME_DOD);
+    BitWriter writer(out);
+    int64_t delta = 1;
+    for (uint32_t i = 1; i < count; i++)
+    {
+        int64_t currDelta = times[i] - times[i - 1];
+        int64_t dod = currDelta - delta;
+        delta = currDelta;
+        if (dod == 0)
+            writer.write(0, 1);
+        else if (dod >= -63 && dod <= 64)
+        {
+            writer.write(2, 2);
+            writer.write(static_cast<uint32_t>(dod + 63), 7);
+        }
+        else if (dod >= -255 && dod <= 256)
+        {
+            writer.write(6, 3);
+            writer.write(static_cast<uint32_t>(dod + 255), 9);
+        }
+        else if (dod >= -2047 && dod <= 2048)
+        {
+            writer.write(14, 4);
+            writer.write(static_cast<uint32_t>(dod + 2047), 12);
+        }
+        else
+        {
+            writer.write(15, 4);
+            writer.write(static_cast<uint32_t>(static_cast<int32_t>(dod)), 32);
+        }
+    }
+    writer.flush();
+}
+
+// control bits per value:
+//   0                          same value
+//   10 <bits>                  meaningful bits fit into the previous window
+//   11 <5: leading> <5: length - 1> <bits>    new window
+void Codec::encodeFloats(const float* values, uint32_t count, BitWriter& writer)
+{
+    if (count == 0)
+        return;
+
+    uint32_t prev = floatToBits(values[0]);
+    uint32_t prevLeading = 32;  // no window yet
+    uint32_t prevTrailing = 0;
+    writer.write(prev, 32);
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        uint32_t curr = floatToBits(values[i]);
+        uint32_t x = curr ^ prev;
+        prev = curr;
+        if (x == 0)
+        {
+            writer.write(0, 1);
+            continue;
+        }
+
+        uint32_t leading = countLeadingZeros(x);
+        uint32_t trailing = countTrailingZeros(x);
+        if (prevLeading != 32 && leading >= prevLeading && trailing >= prevTrailing)
+        {
+            writer.write(2, 2);
+            writer.write(x >> prevTrailing, 32 - prevLeading - prevTrailing);
+        }
+        else
+        {
+            uint32_t length = 32 - leading - trailing;
+            writer.write(3, 2);
+            writer.write(leading, 5);
+            writer.write(length - 1, 5);
+            writer.write(x >> trailing, length);
+            prevLeading = leading;
+            prevTrailing = trailing;
+        }
+    }
+}
+
+bool Codec::decodeFloats(BitReader& reader, float* values, uint32_t count)
+{
+    if (count == 0)
+        return true;
+
+    uint32_t prev = reader.read(32);
+    uint32_t leading = 0;
+    uint32_t length = 0;
+    values[0] = bitsToFloat(prev);
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (reader.read(1))
+        {
+            if (reader.read(1))
+            {
+                leading = reader.read(5);
+                length = reader.read(5) + 1;
+            }
+            prev ^= reader.read(length) << (32 - leading - length);
+        }
+        values[i] = bitsToFloat(prev);
+    }
+    return !reader.isOverrun();
+}
+
+void Codec::encodeFloats(const float* values, uint32_t count, std::vector<uint8_t>& out)
+{
+    BitWriter writer(out);
+    encodeFloats(values, count, writer);
+    writer.flush();
+}
+
+bool Codec::decodeFloats(const uint8_t* data, uint32_t size, float* values, uint32_t count)
+{
+    BitReader reader(data, size);
+    return decodeFloats(reader, values, count);
+}
+
+
+/**
+    Half precision floats
+*/
+uint16_t Codec::floatToHalf(float value)
+{
+    uint32_t bits = floatToBits(value);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF);
+
+    if (exponent == 0xFF)   // inf, nan
+        return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    exponent += 15 - 127;
+    if (exponent >= 31)     // too big
+        return static_cast<uint16_t>(sign | 0x7C00);
+
+    uint32_t shift = 13;
+    if (exponent <= 0)      // subnormal
+    {
+        if (exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        exponent = 0;
+    }
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> shift);
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t middle = 1u << (shift - 1);
+    // a carry out of the mantissa moves to the next exponent, that is still correct
+    if (rest > middle || (rest == middle && (half & 1)))
+        half++;
+    return static_cast<uint16_t>(sign | half);
+}
+
+float Codec::halfToFloat(uint16_t value)
+{
+    uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x3FF;
+
+    if (exponent == 0)      // zero, subnormal
+    {
+        float result = mantissa * (1.0f / 16777216.0f);
+        return sign ? -result : result;
+    }
+    if (exponent == 31)     // inf, nan
+        return bitsToFloat(sign | 0x7F800000 | (mantissa << 13));
+    return bitsToFloat(sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+}
+
+// little endian 16 bit values
+void Codec::encodeHalfs(const float* values, uint32_t count, std::vector<uint8_t>& out)
+{
+    size_t offset = out.size();
+    out.resize(offset + count * 2);
+    uint8_t* p = out.empty() ? NULL : &out[offset];
+    for (uint32_t i = 0; i < count; i++, p += 2)
+    {
+        uint16_t half = floatToHalf(values[i]);
+        p[0] = static_cast<uint8_t>(half);
+        p[1] = static_cast<uint8_t>(half >> 8);
+    }
+}
+
+bool Codec::decodeHalfs(const uint8_t* data, uint32_t size, float* values, uint32_t count)
+{
+    if (size != count * 2)
+        return false;
+    for (uint32_t i = 0; i < count; i++, data += 2)
+        values[i] = halfToFloat(static_cast<uint16_t>(data[0] | (data[1] << 8)));
+    return true;
+}
+
+
+/**
+    Integer columns
+*/
+void Codec::encodeDeltas(const uint32_t* values, uint32_t count, std::vector<uint8_t>& out)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++)
+        sum += values[i];
+    int64_t reference = count ? static_cast<int64_t>(sum / count) : 0;
+
+    putVarint(out, reference);
+    for (uint32_t i = 0; i < count; i++)
+        putVarint(out, zigzagEncode(static_cast<int64_t>(values[i]) - reference));
+}
+
+bool Codec::decodeDeltas(const uint8_t* data, uint32_t size, uint32_t* values, uint32_t count)
+{
+    const uint8_t* end = data + size;
+    uint64_t reference;
+    if (!getVarint(data, end, reference))
+        return false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t value;
+        if (!getVarint(data, end, value))
+            return false;
+        values[i] = static_cast<uint32_t>(static_cast<int64_t>(reference) + zigzagDecode(value));
+    }
+    return true;
+}
+
+// mode byte, nonzero count, then
+//   sparseGaps:    (index gap from the previous nonzero value, value) pairs
+//   sparseBitmap:  bitmap of the nonzero seconds, the nonzero values
+static const uint8_t sparseGaps = 0;
+static const uint8_t sparseBitmap = 1;
+
+void Codec::encodeSparse(const uint32_t* values, uint32_t count, std::vector<uint8_t>& out)
+{
+    uint32_t nonzero = 0;
+    for (uint32_t i = 0; i < count; i++)
+        nonzero += (values[i] != 0);
+
+    // a gap takes at least one byte, the bitmap one bit per second
+    bool bitmap = nonzero > count / 8;
+    out.push_back(bitmap ? sparseBitmap : sparseGaps);
+    putVarint(out, nonzero);
+
+    if (bitmap)
+    {
+        size_t offset = out.size();
+        out.resize(offset + (count + 7) / 8, 0);
+        for (uint32_t i = 0; i < count; i++)
+            if (values[i])
+                out[offset + i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+        for (uint32_t i = 0; i < count; i++)
+            if (values[i])
+                putVarint(out, values[i]);
+    }
+    else
+    {
+        uint32_t prev = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (values[i])
+            {
+                putVarint(out, i - prev);
+                putVarint(out, values[i]);
+                prev = i;
+            }
+        }
+    }
+}
+
+bool Codec::decodeSparse(const uint8_t* data, uint32_t size, uint32_t* values, uint32_t count)
+{
+    const uint8_t* end = data + size;
+    uint64_t nonzero;
+    if (size < 1)
+        return false;
+    uint8_t mode = *data++;
+    if (!getVarint(data, end, nonzero) || nonzero > count)
+        return false;
+
+    memset(values, 0, sizeof(uint32_t) * count);
+    if (mode == sparseBitmap)
+    {
+        const uint8_t* bitmap = data;
+        if (static_cast<uint32_t>(end - data) < (count + 7) / 8)
+            return false;
+        data += (count + 7) / 8;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint64_t value;
+            if (!(bitmap[i / 8] & (1 << (i % 8))))
+                continue;
+            if (!getVarint(data, end, value))
+                return false;
+            values[i] = static_cast<uint32_t>(value);
+        }
+        return true;
+    }
+    if (mode != sparseGaps)
+        return false;
+
+    uint64_t index = 0;
+    for (uint64_t i = 0; i < nonzero; i++)
+    {
+        uint64_t gap;
+        uint64_t value;
+        if (!getVarint(data, end, gap) || !getVarint(data, end, value))
+            return false;
+        index += gap;
+        if (index >= count)
+            return false;
+        values[index] = static_cast<uint32_t>(value);
+    }
+    return true;
+}
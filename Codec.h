@@ -0,0 +1,156 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "Platform.h"
+#include <vector>
+
+/**
+    BitWriter
+    Appends bit fields (MSB first) to the byte buffer
+*/
+class BitWriter
+{
+    private:
+        std::vector<uint8_t>&   m_out;
+        uint64_t                m_acc;      // pending bits
+        uint32_t                m_bits;     // number of pending bits
+
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out);
+        ~BitWriter();
+
+        /// write the lowest bits of the value (bits <= 32)
+        void    write(uint32_t value, uint32_t bits)
+        {
+            m_acc = (m_acc << bits) | (value & (bits < 32 ? ((1u << bits) - 1) : 0xFFFFFFFFu));
+            m_bits += bits;
+            while (m_bits >= 8)
+            {
+                m_bits -= 8;
+                m_out.push_back(static_cast<uint8_t>(m_acc >> m_bits));
+            }
+        }
+        /// pad the last byte with zeros
+        void    flush();
+};
+
+/**
+    BitReader
+    Reads bit fields written by BitWriter
+*/
+class BitReader
+{
+    private:
+        const uint8_t*  m_data;
+        const uint8_t*  m_end;
+        uint64_t        m_acc;
+        uint32_t        m_bits;
+        bool            m_overrun;  // read past the end of the data
+
+    public:
+        BitReader(const uint8_t* data, uint32_t size);
+        ~BitReader();
+
+        /// read bits (bits <= 32)
+        uint32_t    read(uint32_t bits)
+        {
+            while (m_bits < bits)
+            {
+                if (m_data < m_end)
+                    m_acc = (m_acc << 8) | *m_data++;
+                else
+                {
+                    m_acc <<= 8;
+                    m_overrun = true;
+                }
+                m_bits += 8;
+            }
+            m_bits -= bits;
+            return static_cast<uint32_t>(m_acc >> m_bits) & (bits < 32 ? ((1u << bits) - 1) : 0xFFFFFFFFu);
+        }
+        bool        isOverrun() const { return m_overrun; }
+        /// bytes consumed (the partial byte counts as consumed)
+        const uint8_t*  getPosition() const { return m_data; }
+};
+
+/**
+    TimeIndex
+    Timestamps of the block: base time, count and gap list for dense
+    (one per second) data, delta-of-delta for the irregular one.
+    Dense timestamps are computed from the index without decoding
+*/
+class TimeIndex
+{
+    private:
+        struct Gap
+        {
+            uint32_t    index;      // first sample after the gap
+            int64_t     offset;     // total extra seconds up to and including this gap
+        };
+
+        int64_t                 m_base;
+        uint32_t                m_count;
+        bool                    m_dense;
+        std::vector<Gap>        m_gaps;     // dense mode
+        std::vector<int64_t>    m_times;    // delta-of-delta mode, decoded
+
+    public:
+        TimeIndex();
+        ~TimeIndex();
+
+        /// parse encoded timestamps, returns the number of bytes used (0 = error)
+        uint32_t    parse(const uint8_t* data, uint32_t size);
+
+        /// access
+        uint32_t    getCount() const;
+        bool        isDense() const;
+        int64_t     getTime(uint32_t index) const;
+        /// index of the first sample with time >= given one (getCount() if none)
+        uint32_t    findTime(int64_t time) const;
+        /// all timestamps
+        void        decode(int64_t* times) const;
+};
+
+/**
+    Codec
+    Column encodings for the time series blocks
+*/
+namespace Codec
+{
+    /// LEB128 varints and zigzag mapping of the signed values
+    void    putVarint(std::vector<uint8_t>& out, uint64_t value);
+    bool    getVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value);
+    inline uint64_t zigzagEncode(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+    inline int64_t  zigzagDecode(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+    /// timestamps (see TimeIndex)
+    void    encodeTimes(const int64_t* times, uint32_t count, std::vector<uint8_t>& out);
+
+    /// XOR float encoding (Gorilla): every value is XORed with the previous one,
+    /// only the meaningful bits of the result are stored
+    void    encodeFloats(const float* values, uint32_t count, BitWriter& writer);
+    bool    decodeFloats(BitReader& reader, float* values, uint32_t count);
+
+    /// the same for a whole buffer
+    void    encodeFloats(const float* values, uint32_t count, std::vector<uint8_t>& out);
+    bool    decodeFloats(const uint8_t* data, uint32_t size, float* values, uint32_t count);
+
+    /// IEEE 754 half precision (round to nearest even), for the reduced precision PCR storage
+    uint16_t    floatToHalf(float value);
+    float       halfToFloat(uint16_t value);
+    void        encodeHalfs(const float* values, uint32_t count, std::vector<uint8_t>& out);
+    bool        decodeHalfs(const uint8_t* data, uint32_t size, float* values, uint32_t count);
+
+    /// integers close to a common value (rate): the block reference value,
+    /// then zigzag varints of the differences from it
+    void    encodeDeltas(const uint32_t* values, uint32_t count, std::vector<uint8_t>& out);
+    bool    decodeDeltas(const uint8_t* data, uint32_t size, uint32_t* values, uint32_t count);
+
+    /// integers that are mostly zero (mediaLossRate): only the nonzero values are
+    /// stored, located by the index gaps (few of them) or by a bitmap (many of them).
+    /// An all-zero block takes 2 bytes
+    void    encodeSparse(const uint32_t* values, uint32_t count, std::vector<uint8_t>& out);
+    bool    decodeSparse(const uint8_t* data, uint32_t size, uint32_t* values, uint32_t count);
+};
+
+#endif // CODEC_H
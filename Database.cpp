@@ -1,5 +1,20 @@
 #include "Database.h"
 #include "Timer.h"
+#include "TokenBucket.h"
+#include "DumpReader.h"
+#include "Codec.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+/// system specific includes
+#ifdef OS_WINDOWS
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <dirent.h>
+#endif
 
 
 #define L_HEAD_FMT_IN  ",%10s,%10s,%10s"
@@ -26,6 +41,101 @@
 
 
 
+/// binary dump: header is the magic, record size and flags, then the records: the time and the
+/// fields of LogSample one by one, little-endian and without padding
+static const char dumpBinaryMagic[8] = { 'D', 'B', 'D', 'U', 'M', 'P', 'B', '2' };
+static const uint32_t dumpBinaryHeaderSize = sizeof(dumpBinaryMagic) + 2 * sizeof(uint32_t);
+static const uint32_t dumpBinaryInputSize = 3 * sizeof(uint32_t) + sizeof(uint8_t) + maxSamples * sizeof(float);
+static const uint32_t dumpBinaryOutputSize = 2 * sizeof(uint32_t) + sizeof(uint8_t) + maxSamples * sizeof(float);
+static const uint32_t dumpBinaryRecordSize = sizeof(int64_t) + sizeof(uint32_t) + 4 * dumpBinaryInputSize
+                                             + 2 * dumpBinaryOutputSize;
+#ifdef HIER_MODE_SUPPORTED
+static const uint32_t dumpBinaryFlags = 1;
+#else
+static const uint32_t dumpBinaryFlags = 0;
+#endif
+
+/// samples per import transaction
+static const uint32_t importBatchSize = 16384;
+/// records of the queued ingest per transaction at most
+static const uint32_t ingestBatchSize = 4096;
+/// weight of the last write in the writer latency, and the decay while there are no writes (seconds)
+static const double writerLatencyWeight = 0.25;
+static const double writerLatencyHalfLife = 1.0;
+
+/// fields of the binary dump
+static char* putUint32(char* p, uint32_t value)
+{
+    for (uint32_t i = 0; i < 4; i++)
+        p[i] = static_cast<char>(value >> (8 * i));
+    return p + 4;
+}
+
+static char* putFloat(char* p, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return putUint32(p, bits);
+}
+
+static const char* getUint32(const char* p, uint32_t& value)
+{
+    value = 0;
+    for (uint32_t i = 0; i < 4; i++)
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return p + 4;
+}
+
+static const char* getFloat(const char* p, float& value)
+{
+    uint32_t bits;
+    p = getUint32(p, bits);
+    memcpy(&value, &bits, sizeof(value));
+    return p;
+}
+
+static char* putInput(char* p, const InputData& in)
+{
+    p = putFloat(p, in.delayFactor);
+    p = putUint32(p, in.mediaLossRate);
+    p = putUint32(p, in.rate);
+    *p++ = static_cast<char>(in.samples);
+    for (uint32_t i = 0; i < maxSamples; i++)
+        p = putFloat(p, in.pcrArray[i]);
+    return p;
+}
+
+static char* putOutput(char* p, const OutputData& out)
+{
+    p = putFloat(p, out.delayFactor);
+    p = putUint32(p, out.rate);
+    *p++ = static_cast<char>(out.samples);
+    for (uint32_t i = 0; i < maxSamples; i++)
+        p = putFloat(p, out.pcrArray[i]);
+    return p;
+}
+
+static const char* getInput(const char* p, InputData& in)
+{
+    p = getFloat(p, in.delayFactor);
+    p = getUint32(p, in.mediaLossRate);
+    p = getUint32(p, in.rate);
+    in.samples = static_cast<uint8_t>(*p++);
+    for (uint32_t i = 0; i < maxSamples; i++)
+        p = getFloat(p, in.pcrArray[i]);
+    return p;
+}
+
+static const char* getOutput(const char* p, OutputData& out)
+{
+    p = getFloat(p, out.delayFactor);
+    p = getUint32(p, out.rate);
+    out.samples = static_cast<uint8_t>(*p++);
+    for (uint32_t i = 0; i < maxSamples; i++)
+        p = getFloat(p, out.pcrArray[i]);
+    return p;
+}
+
 static uint32_t sqliteReset(sqlite3_stmt* pStmt)
 {
     uint32_t errorCode = sqlite3_reset(pStmt);
@@ -38,6 +148,21 @@ static uint32_t sqliteReset(sqlite3_stmt* pStmt)
     return errorCode;
 }
 
+/// statement of the cache (see Database::getStatement), reset at the end of the scope
+struct CachedRequest
+{
+    sqlite3_stmt* pStmt;
+
+    explicit CachedRequest(sqlite3_stmt* stmt) : pStmt(stmt)
+    {
+    }
+    ~CachedRequest()
+    {
+        if (pStmt)
+            sqliteReset(pStmt);
+    }
+};
+
 struct SQLiteRequest
 {
     sqlite3_stmt* pStmt;
@@ -54,6 +179,111 @@ struct SQLiteRequest
 };
 
 
+/// PCR values of a row: floats, or halves when the buffer for them is given
+/// (it has to live until the step). The blob size tells them apart on the read
+static void bindPcr(sqlite3_stmt* pStmt, int column, const float* pcr, uint8_t samples, uint16_t* halves)
+{
+    if (!halves)
+    {
+        sqlite3_bind_blob(pStmt, column, pcr, sizeof(float) * samples, NULL);
+        return;
+    }
+    samples = std::min<uint8_t>(samples, maxSamples);
+    for (uint8_t i = 0; i < samples; i++)
+        halves[i] = Codec::floatToHalf(pcr[i]);
+    sqlite3_bind_blob(pStmt, column, halves, sizeof(uint16_t) * samples, NULL);
+}
+
+static void readPcr(sqlite3_stmt* pStmt, int column, float* pcr, uint8_t samples)
+{
+    const uint8_t* blob = static_cast<const uint8_t*>(sqlite3_column_blob(pStmt, column));
+    uint32_t bytes = sqlite3_column_bytes(pStmt, column);
+    samples = std::min<uint8_t>(samples, maxSamples);
+    if (samples && bytes == sizeof(uint16_t) * samples)
+        Codec::decodeHalfs(blob, bytes, pcr, samples);
+    else if (bytes)
+        memcpy(pcr, blob, std::min<uint32_t>(bytes, sizeof(float) * samples));
+}
+
+static void bindInput(sqlite3_stmt* pStmt, uint32_t stream, const InputData* in, time_t currTime, uint16_t* halves)
+{
+    sqlite3_bind_double(pStmt, 1, in->delayFactor);
+    sqlite3_bind_int(pStmt, 2, in->mediaLossRate);
+    sqlite3_bind_int(pStmt, 3, in->rate);
+    bindPcr(pStmt, 4, in->pcrArray, in->samples, halves);
+    sqlite3_bind_int(pStmt, 5, in->samples);
+    sqlite3_bind_int(pStmt, 6, currTime);
+    sqlite3_bind_int(pStmt, 7, stream);
+}
+
+static void bindOutput(sqlite3_stmt* pStmt, uint32_t stream, const OutputData* out, time_t currTime, uint16_t* halves)
+{
+    sqlite3_bind_double(pStmt, 1, out->delayFactor);
+    sqlite3_bind_int(pStmt, 2, out->rate);
+    bindPcr(pStmt, 3, out->pcrArray, out->samples, halves);
+    sqlite3_bind_int(pStmt, 4, out->samples);
+    sqlite3_bind_int(pStmt, 5, currTime);
+    sqlite3_bind_int(pStmt, 6, stream);
+}
+
+/// number parsers for the dump import (fixed format, no locale)
+static void skipSpaces(const char*& p, const char* end)
+{
+    while (p < end && *p == ' ')
+        p++;
+}
+
+static bool parseUInt(const char*& p, const char* end, uint64_t& value)
+{
+    skipSpaces(p, end);
+    const char* begin = p;
+    value = 0;
+    while (p < end && static_cast<unsigned>(*p - '0') < 10)
+        value = value * 10 + (*p++ - '0');
+    return (p != begin);
+}
+
+static bool parseFloat(const char*& p, const char* end, float& value)
+{
+    skipSpaces(p, end);
+    bool negative = (p < end && *p == '-');
+    if (negative)
+        p++;
+
+    uint64_t intPart = 0;
+    const char* begin = p;
+    while (p < end && static_cast<unsigned>(*p - '0') < 10)
+        intPart = intPart * 10 + (*p++ - '0');
+    double result = static_cast<double>(intPart);
+    if (p < end && *p == '.')
+    {
+        p++;
+        uint64_t fraction = 0;
+        double scale = 1.0;
+        for (; p < end && static_cast<unsigned>(*p - '0') < 10; p++)
+        {
+            // digits beyond the double precision are ignored
+            if (scale < 1e18)
+            {
+                fraction = fraction * 10 + (*p - '0');
+                scale *= 10.0;
+            }
+        }
+        result += fraction / scale;
+    }
+    value = static_cast<float>(negative ? -result : result);
+    return (p != begin);
+}
+
+static bool parseSeparator(const char*& p, const char* end)
+{
+    skipSpaces(p, end);
+    if (p == end || *p != ',')
+        return false;
+    p++;
+    return true;
+}
+
 static bool isDataSourceSupported(DataSource source)
 {
     switch (source)
@@ -70,6 +300,21 @@ static bool isDataSourceSupported(DataSource source)
     }
 }
 
+static std::string getChunkTableName(DataSource source)
+{
+    switch (source)
+    {
+    default: return "";
+    case DS_IN_HP1: return  "'HP1Chunks'";
+    case DS_IN_HP2: return  "'HP2Chunks'";
+    case DS_OUT_HP: return "'HPOutChunks'";
+
+    case DS_IN_LP1: return "'LP1Chunks'";
+    case DS_IN_LP2: return "'LP2Chunks'";
+    case DS_OUT_LP: return "'LPOutChunks'";
+    }
+}
+
 static std::string getTableName(DataSource source)
 {
     switch (source)
@@ -85,30 +330,159 @@ static std::string getTableName(DataSource source)
     }
 }
 
-Database::Database(const std::string& fileName, bool bRecreate) : m_pDb(NULL), m_limit(5000),
-m_atomicDumpSize(1000), m_transPackSize(100), m_dbFileName(fileName)
+// rows from partitionTime on (DatabaseOptions::partitionSeconds): 'HP1_1600000000'
+static std::string getPartitionPrefix(DataSource source)
+{
+    std::string name = getTableName(source);
+    return name.empty() ? name : name.substr(1, name.size() - 2) + "_";
+}
+
+static std::string getPartitionName(DataSource source, time_t partitionTime)
+{
+    std::stringstream ss;
+    ss << "'" << getPartitionPrefix(source) << partitionTime << "'";
+    return ss.str();
+}
+
+// schema of an attached partition file
+static std::string getPartitionSchema(time_t partitionTime)
+{
+    std::stringstream ss;
+    ss << "p" << partitionTime;
+    return ss.str();
+}
+
+// SQLite attaches up to 10 files to a connection, the writer keeps its insert partition
+static const size_t partitionsPerQuery = 8;
+
+static std::string getRowColumns(bool input)
+{
+    return input ? "(delayFactor float, mediaLossRate integer, rate integer, pcrArray blob, samples integer,\
+                     time integer, stream integer NOT NULL DEFAULT 0)"
+                 : "(delayFactor float, rate integer, pcrArray blob, samples integer, time integer,\
+                     stream integer NOT NULL DEFAULT 0)";
+}
+
+static const time_t endOfTime = std::numeric_limits<time_t>::max();
+
+int delFucnt(const std::string& buffName);
+
+Database::Database(const std::string& fileName, bool bRecreate, const DatabaseOptions& options) : m_pDb(NULL),
+m_limit(5000), m_atomicDumpSize(1000), m_transPackSize(100), m_dbFileName(fileName), m_pendingWriters(0), m_writesDone(0),
+m_writerLatency(0), m_lastWrite(0), m_writeAcquired(0), m_writeWait(0), m_writeContended(false), m_writeSite(LOCK_SITE_ADD), m_options(options), m_openChunkTime(0), m_openChunkSaved(0), m_rejectedSamples(0), m_compacted(false),
+m_insertPartition(-1), m_prevPartition(-1), m_newestTime(0),
+m_blockCache(options.blockCacheSize), m_tasks(options.maintenanceThreads), m_queries(options.queryThreads), m_checkpointDb(NULL),
+m_walPages(0), m_walBackfilled(0), m_clears(0), m_backups(0), m_ingestStop(false), m_ingestIdle(false), m_ingestBusy(false),
+m_ingestFlushes(0), m_ingestWritten(0)
 {
+    for (uint32_t i = 0; i < STMT_TOTAL; i++)
+        m_statements[i] = NULL;
+    for (uint32_t i = 0; i <= DS_COUNT; i++)
+        m_prevStatements[i] = NULL;
+    if (m_options.chunkSeconds == 0)
+        m_options.chunkSeconds = 1;
+    if (m_options.maxStreams == 0)
+        m_options.maxStreams = 1;
+    m_totalSamples.reset(new std::atomic<uint32_t>[m_options.maxStreams]());
+    m_startTime.reset(new std::atomic<time_t>[m_options.maxStreams]());
+    // the first stored channel gives the time and the count of the samples
+    m_refSource = DS_COUNT;
+    for (uint32_t i = 0; i < DS_COUNT && m_refSource == DS_COUNT; i++)
+    {
+        if (isStored(static_cast<DataSource>(i)))
+            m_refSource = static_cast<DataSource>(i);
+    }
+    if (m_refSource == DS_COUNT)
+    {
+        m_options.channels = ~0u;
+        m_refSource = DS_IN_HP1;
+    }
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+        m_openChunk.push_back(ChannelBlock(i < DS_IN_TOTAL));
+    m_lockProfiler.setEnabled(m_options.lockStats);
+    // submitted by the commits from the first open on
+    if (m_options.wal)
+    {
+        m_checkpointTask = TaskPool::createTask("checkpoint", TASK_NORMAL,
+                                                [this](PoolTask&) { checkpointTaskFunc(); });
+    }
+
     createEmptyDb();
     open(fileName, bRecreate);
     createTables();
+    loadPartitions();
+    loadOpenChunk();
+    updateAllCounters();
+
+    if (!m_options.liveViewName.empty())
+        m_liveView.open(m_options.liveViewName, m_options.maxStreams, m_options.liveViewSeconds);
+
+    m_retentionTask = TaskPool::createTask("retention", TASK_CRITICAL, [this](PoolTask&) { applyRetention(); });
+    if (m_options.storage == STORAGE_ROWS && m_options.compactAfterSeconds > 0)
+    {
+        m_compactTask = TaskPool::createTask("compaction", TASK_NORMAL,
+                                             [this](PoolTask& task) { compactTaskFunc(task); });
+        m_tasks.submit(m_compactTask);
+    }
+    if (m_options.ingestQueueSize > 0)
+    {
+        m_ingestQueue.reset(new IngestQueue<IngestRecord>(m_options.ingestQueueSize, m_options.ingestPolicy));
+        m_streamAdded.resize(m_options.maxStreams);
+        m_touchedStreams.reserve(std::min<uint32_t>(m_options.maxStreams, ingestBatchSize));
+        m_ingestThread = std::thread(&Database::ingestThreadFunc, this);
+    }
 }
 
 Database::~Database()
 {
+    stopIngest();
+    // the queued reads are answered
+    m_queries.stop();
+    if (m_compactTask)
+        m_compactTask->cancel();
+    cancelDumps();
+    // the queued retention still runs, the database is open until then
+    m_tasks.stop();
     close();
 }
 
 bool Database::open(const std::string& fileName, bool bRecreate)
 {
-    m_DbMutex.lock();
+    beginWrite(LOCK_SITE_OPEN);
+    bool bResult = internalOpen(fileName, bRecreate);
+    endWrite();
+    return bResult;
+}
+
+// under the writer lock
+bool Database::internalOpen(const std::string& fileName, bool bRecreate)
+{
     uint32_t iResult = sqlite3_open_v2(fileName.c_str(), &m_pDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
         | SQLITE_OPEN_FULLMUTEX, NULL);
     if (bRecreate && iResult == SQLITE_OK)
     {
         std::stringstream ss;
+        std::vector<time_t> partitions = findPartitions();
+        if (usesPartitionFiles())
+        {
+            for (size_t j = 0; j < partitions.size(); j++)
+                delFucnt(getPartitionFileName(partitions[j]));
+            partitions.clear();
+            // the registry of the files written by the earlier versions
+            sqlite3_exec(m_pDb, "DROP TABLE IF EXISTS Partitions", NULL, NULL, NULL);
+        }
         for (uint32_t i = 0; i < DS_COUNT; i++)
         {
             DataSource DS = static_cast<DataSource>(i);
+            ss << "DROP TABLE IF EXISTS " << getChunkTableName(DS) << ";";
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+            for (size_t j = 0; j < partitions.size(); j++)
+            {
+                ss << "DROP TABLE IF EXISTS " << getPartitionName(DS, partitions[j]);
+                sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+                ss.str("");
+            }
             ss << "DROP TABLE IF EXISTS " << getTableName(DS) << ";";
 
             SQLiteRequest req(m_pDb, ss.str());
@@ -117,16 +491,182 @@ bool Database::open(const std::string& fileName, bool bRecreate)
             ss.str("");
         }
     }
-    m_DbMutex.unlock();
+    // the template of clear() is only copied: no WAL, no other connections
+    bool live = (fileName != m_dbEmptyFileName);
+    if (iResult == SQLITE_OK && live && m_options.wal)
+    {
+        // the commits don't checkpoint: the hook replaces the automatic checkpoints
+        sqlite3_exec(m_pDb, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+        sqlite3_wal_hook(m_pDb, walHook, this);
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        if (sqlite3_open_v2(fileName.c_str(), &m_checkpointDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                            NULL) == SQLITE_OK)
+        {
+            // a connection that has not read the file yet doesn't see the WAL
+            sqlite3_exec(m_checkpointDb, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+            sqlite3_busy_timeout(m_checkpointDb, 50);
+        }
+        else
+        {
+            sqlite3_close(m_checkpointDb);
+            m_checkpointDb = NULL;
+        }
+    }
+    if (iResult == SQLITE_OK && live)
+        m_readers.open(fileName);
     return(iResult == SQLITE_OK);
 }
 
 void Database::close()
 {
-    m_DbMutex.lock();
-    sqlite3_close(m_pDb);
+    beginWrite(LOCK_SITE_CLOSE);
+    if (m_options.storage == STORAGE_CHUNKED && m_pDb)
+        saveOpenChunk();
+    internalClose();
+    endWrite();
+}
+
+// false when the connection was still in use: it is closed by SQLite once released
+bool Database::internalClose()
+{
+    // the readers are out: they hold the shared lock while they use a connection
+    m_readers.close();
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        sqlite3_close(m_checkpointDb);
+        m_checkpointDb = NULL;
+        m_walPages = 0;
+        m_walBackfilled = 0;
+    }
+    finalizeStatements();
+    bool bResult = (sqlite3_close(m_pDb) == SQLITE_OK);
+    if (!bResult)
+        sqlite3_close_v2(m_pDb);
     m_pDb = NULL;
+    return bResult;
+}
+
+bool Database::isStored(DataSource source) const
+{
+    return isDataSourceSupported(source) && (m_options.channels & (1u << source));
+}
+
+void Database::beginWrite(LockSite site)
+{
+    m_pendingWriters++;
+    if (!m_lockProfiler.isEnabled())
+    {
+        m_DbMutex.lock();
+        return;
+    }
+    uint64_t start = LockProfiler::now();
+    bool contended = !m_DbMutex.try_lock();
+    if (contended)
+        m_DbMutex.lock();
+    m_writeAcquired = LockProfiler::now();
+    m_writeSite = site;
+    m_writeWait = m_writeAcquired - start;
+    m_writeContended = contended;
+}
+
+void Database::endWrite()
+{
+    // the profiler may have been enabled while the lock was held
+    if (m_writeAcquired)
+    {
+        m_lockProfiler.record(m_writeSite, m_writeContended, m_writeWait, LockProfiler::now() - m_writeAcquired);
+        m_writeAcquired = 0;
+    }
     m_DbMutex.unlock();
+    {
+        std::lock_guard<std::mutex> lock(m_writerGate);
+        m_writesDone++;
+        m_pendingWriters--;
+    }
+    m_writerGateCond.notify_all();
+}
+
+sqlite3* Database::beginRead(LockSite site)
+{
+    // the queued writer goes first, otherwise the polling readers could keep the shared lock forever;
+    // the reader waits for one write at most, so a busy writer can't starve it either
+    if (m_pendingWriters > 0)
+    {
+        std::unique_lock<std::mutex> lock(m_writerGate);
+        uint64_t writes = m_writesDone;
+        m_writerGateCond.wait(lock, [this, writes] { return m_pendingWriters == 0 || m_writesDone != writes; });
+    }
+    // the yield to the writer is the policy, the wait for the lock is timed from here
+    bool profiled = m_lockProfiler.isEnabled();
+    uint64_t start = profiled ? LockProfiler::now() : 0;
+    bool contended = false;
+    if (!profiled)
+        m_DbMutex.lock_shared();
+    else if (!m_DbMutex.try_lock_shared())
+    {
+        contended = true;
+        m_DbMutex.lock_shared();
+    }
+    sqlite3* db = m_readers.acquire();
+    if (!db)
+    {
+        m_DbMutex.unlock_shared();
+        return db;
+    }
+    if (profiled)
+    {
+        uint64_t acquired = LockProfiler::now();
+        ReadLockTiming timing = { acquired, acquired - start, contended, site };
+        std::lock_guard<std::mutex> lock(m_readTimingsMutex);
+        m_readTimings[db] = timing;
+    }
+    return db;
+}
+
+void Database::endRead(sqlite3* db)
+{
+    if (m_lockProfiler.isEnabled())
+    {
+        std::unique_lock<std::mutex> lock(m_readTimingsMutex);
+        std::map<sqlite3*, ReadLockTiming>::iterator it = m_readTimings.find(db);
+        if (it != m_readTimings.end())
+        {
+            ReadLockTiming timing = it->second;
+            m_readTimings.erase(it);
+            lock.unlock();
+            m_lockProfiler.record(timing.site, timing.contended, timing.wait, LockProfiler::now() - timing.acquired);
+        }
+    }
+    m_readers.release(db);
+    m_DbMutex.unlock_shared();
+}
+
+// the metadata for the readers, after every change (under the writer lock)
+void Database::updateCounters(uint32_t stream)
+{
+    if (!m_pDb)
+        return;
+    m_totalSamples[stream] = internalGetTotalSamples(stream);
+    m_startTime[stream] = internalGetStartTime(stream);
+}
+
+void Database::updateAllCounters()
+{
+    for (uint32_t i = 0; i < m_options.maxStreams; i++)
+        updateCounters(i);
+}
+
+// the files written before the streams have no stream column
+static bool hasColumn(sqlite3* db, const std::string& table, const char* column)
+{
+    SQLiteRequest req(db, "PRAGMA table_info(" + table + ")");
+    while (req.pStmt && sqlite3_step(req.pStmt) == SQLITE_ROW)
+    {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(req.pStmt, 1));
+        if (name && strcmp(name, column) == 0)
+            return true;
+    }
+    return false;
 }
 
 void Database::createTables()
@@ -136,15 +676,9 @@ void Database::createTables()
     for (uint32_t i = 0; i < DS_IN_TOTAL; i++)
     {
         DataSource DS = static_cast<DataSource>(i);
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
-        ss << "CREATE TABLE IF NOT EXISTS " << getTableName(DS) << "(\
-							delayFactor				float,\
-							mediaLossRate			integer,\
-							rate					integer,\
-							pcrArray				blob,\
-							samples			integer,\
-							time					integer);";
+        ss << "CREATE TABLE IF NOT EXISTS " << getTableName(DS) << getRowColumns(true);
 
         SQLiteRequest req(m_pDb, ss.str());
         sqlite3_step(req.pStmt); // 		
@@ -153,273 +687,2561 @@ void Database::createTables()
     for (uint32_t i = DS_OUT_BASE; i < DS_COUNT; i++)
     {
         DataSource DS = static_cast<DataSource>(i);
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
-        ss << "CREATE TABLE IF NOT EXISTS " << getTableName(DS) << "(\
-							delayFactor				float,\
-							rate					integer,\
-							pcrArray				blob,\
-							samples			integer,\
-							time					integer);";
+        ss << "CREATE TABLE IF NOT EXISTS " << getTableName(DS) << getRowColumns(false);
 
         SQLiteRequest req(m_pDb, ss.str());
         sqlite3_step(req.pStmt); // 			
         ss.str("");
     }
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+        // stream of the rows for the older files
+        if (!hasColumn(m_pDb, getTableName(DS), "stream"))
+        {
+            ss << "ALTER TABLE " << getTableName(DS) << " ADD COLUMN stream integer NOT NULL DEFAULT 0";
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+        }
+        // the time ranges of the reads and the scans, the queries of one stream don't read the rows of the others
+        ss << "CREATE INDEX IF NOT EXISTS 'StreamIndex" << i << "' ON " << getTableName(DS) << "(stream, time)";
+        sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+        ss.str("");
+
+        ss << "CREATE TABLE IF NOT EXISTS " << getChunkTableName(DS) << "(\
+							chunkTime				integer primary key,\
+							startTime				integer,\
+							endTime					integer,\
+							count					integer,\
+							data					blob,\
+							minDelayFactor			float,\
+							maxDelayFactor			float,\
+							minRate					integer,\
+							maxRate					integer,\
+							maxMediaLossRate		integer,\
+							sumMediaLossRate		integer,\
+							lossSeconds				integer);";
+
+        SQLiteRequest req(m_pDb, ss.str());
+        sqlite3_step(req.pStmt);
+        ss.str("");
+    }
     sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
 }
 
-time_t Database::getStartTime()
-{
-    m_DbMutex.lock();
-    SQLiteRequest req(m_pDb, "SELECT MIN(time) as time FROM 'HP1'");
+time_t Database::getStartTime()
+{
+    return getStartTime(0);
+}
+
+time_t Database::getStartTime(uint32_t stream)
+{
+    return (stream < m_options.maxStreams) ? m_startTime[stream].load() : 0;
+}
+
+// the chunks hold stream 0 only
+time_t Database::internalGetStartTime(uint32_t stream)
+{
+    // compacted rows are older than the rest
+    if (stream == 0 && usesChunks())
+    {
+        CachedRequest req(getStatement(STMT_START_CHUNKS));
+        if (sqlite3_step(req.pStmt) == SQLITE_ROW && sqlite3_column_type(req.pStmt, 0) != SQLITE_NULL)
+            return sqlite3_column_int64(req.pStmt, 0);
+    }
+    if (stream == 0 && m_options.storage == STORAGE_CHUNKED)
+        return m_openChunk[m_refSource].empty() ? 0 : m_openChunk[m_refSource].time.front();
+    if (isPartitioned())
+    {
+        for (size_t i = 0; i < m_partitions.size(); i++)
+        {
+            uint32_t count;
+            time_t startTime;
+            countPartitionRows(m_partitions[i], stream, count, startTime);
+            if (count > 0)
+                return startTime;
+        }
+        return 0;
+    }
+
+    CachedRequest req(getStatement(STMT_START_ROWS));
+    sqlite3_bind_int(req.pStmt, 1, stream);
+    time_t startTime = 0;
+    if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+    {
+        startTime = sqlite3_column_int(req.pStmt, 0);
+    }
+    return startTime;
+}
+
+uint32_t Database::internalGetTotalSamples(uint32_t stream)
+{
+    if (stream == 0 && m_options.storage == STORAGE_CHUNKED)
+        return getChunkedTotalSamples(m_refSource);
+    uint32_t totalSamples = 0;
+    if (isPartitioned())
+    {
+        for (size_t i = 0; i < m_partitions.size(); i++)
+        {
+            uint32_t count;
+            time_t startTime;
+            countPartitionRows(m_partitions[i], stream, count, startTime);
+            totalSamples += count;
+        }
+    }
+    else
+    {
+        CachedRequest req(getStatement(STMT_COUNT_ROWS));
+        sqlite3_bind_int(req.pStmt, 1, stream);
+        if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+            totalSamples = sqlite3_column_int(req.pStmt, 0);
+    }
+    if (stream == 0 && usesChunks())
+        totalSamples += getChunkedTotalSamples(m_refSource); // compacted rows
+    return totalSamples;
+}
+
+uint32_t Database::getTotalSamples()
+{
+    return getTotalSamples(0);
+}
+
+uint32_t Database::getTotalSamples(uint32_t stream)
+{
+    return (stream < m_options.maxStreams) ? m_totalSamples[stream].load() : 0;
+}
+
+bool Database::verifyIntegrity()
+{
+    uint32_t iTotal = 0;
+    uint32_t iCurrent = 0;
+    bool iResult = true;
+    std::stringstream ss;
+    sqlite3* db = beginRead(LOCK_SITE_VERIFY);
+    if (!db)
+        return false;
+    uint32_t rows[DS_COUNT] = { 0 };
+    forEachPartitionGroup(db, 0, endOfTime, [&](time_t groupStart, time_t groupEnd)
+    {
+        for (uint32_t i = 0; i < DS_COUNT; i++)
+        {
+            if (!isStored(static_cast<DataSource>(i)))
+                continue;
+            ss << "SELECT COUNT(*) FROM " << getRowSource(static_cast<DataSource>(i), groupStart, groupEnd);
+            SQLiteRequest req(db, ss.str());
+            ss.str("");
+            if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+                rows[i] += sqlite3_column_int(req.pStmt, 0);
+        }
+        return true;
+    });
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+        // rows, saved chunks and the rest of the open chunk
+        ss << "SELECT IFNULL(SUM(count), 0) FROM " << getChunkTableName(DS) << " WHERE chunkTime != " << m_openChunkTime;
+        SQLiteRequest req(db, ss.str());
+
+        sqlite3_step(req.pStmt);
+        iCurrent = rows[i] + sqlite3_column_int(req.pStmt, 0) + static_cast<uint32_t>(m_openChunk[DS].size());
+        if (iTotal == 0 && iCurrent != 0)
+        {
+            iTotal = iCurrent;
+        }
+        else if (iTotal != iCurrent)
+        {
+            iResult = false;
+            break;
+        }
+        ss.str("");
+    }
+    endRead(db);
+    return iResult;
+}
+
+void Database::add(time_t startTime, const LogSample* samples, uint32_t count)
+{
+    add(0, startTime, samples, count);
+}
+
+void Database::add(uint32_t stream, time_t startTime, const LogSample* samples, uint32_t count)
+{
+    if (stream >= m_options.maxStreams)
+        return;
+    beginWrite(LOCK_SITE_ADD);
+    Timer timer(true);
+    static uint32_t counter = 0;
+    if (stream == 0 && m_options.storage == STORAGE_CHUNKED)
+    {
+        addChunked(startTime, samples, count);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {       
+            if (i % 100 == 0 && i != 0)
+                std::cout << i << " -  " << counter << " ITERATION" << '\n';
+            addToInput(stream, startTime + i, samples[i]);
+            addToOutput(stream, startTime + i, samples[i]);
+        }
+    }
+    m_liveView.publish(stream, startTime, samples, count);
+    counter++;
+    updateCounters(stream);
+    recordWrite(timer.stop());
+    endWrite();
+    if (m_totalSamples[stream] > m_limit)
+        scheduleRetention();
+}
+
+
+void Database::addT(time_t startTime, const LogSample* samples, uint32_t count)
+{
+    addT(0, startTime, samples, count);
+}
+
+void Database::addT(uint32_t stream, time_t startTime, const LogSample* samples, uint32_t count)
+{
+    if (stream >= m_options.maxStreams)
+        return;
+    beginWrite(LOCK_SITE_ADD_T);
+    Timer timer(true);
+    if (stream == 0 && m_options.storage == STORAGE_CHUNKED)
+    {
+        addChunked(startTime, samples, count);
+    }
+    else
+    {
+        uint32_t entire = count / m_transPackSize; // -  
+        uint32_t balance = count % m_transPackSize; //      
+
+        uint32_t transPackSize;
+        uint32_t progress;
+        uint32_t j;
+        for (uint32_t i = 0; i <= entire; i++)
+        {
+            j = i * m_transPackSize;
+            if (i != entire)
+                transPackSize = m_transPackSize;
+            else
+                transPackSize = balance;
+
+            progress = (balance == 0) ? (j) : (i != entire) ? (j) : ((i - 1) * m_transPackSize + balance);
+            if (progress % 10000 == 0 && progress != 0)
+                std::cout << progress << '\n';
+            addToInputT(stream, startTime + j, samples + j, transPackSize);
+            addToOutputT(stream, startTime + j, samples + j, transPackSize);
+        }
+    }
+    m_liveView.publish(stream, startTime, samples, count);
+    updateCounters(stream);
+    recordWrite(timer.stop());
+    endWrite();
+    if (m_totalSamples[stream] > m_limit)
+        scheduleRetention();
+}
+
+
+
+
+uint32_t Database::get(LogSample* samples, uint32_t count, time_t startTime)
+{
+    return get(0, samples, count, startTime);
+}
+
+uint32_t Database::get(uint32_t stream, LogSample* samples, uint32_t count, time_t startTime, time_t* firstTime)
+{
+    if (stream >= m_options.maxStreams)
+        return 0;
+    uint32_t localCount = 0;
+    uint32_t iResult = 0;
+    while (count > 0)
+    {
+        localCount = internalGet(stream, samples + iResult, count, startTime);
+        if (localCount == 0)
+            break;
+        if (iResult == 0 && firstTime)
+            *firstTime = startTime - localCount;
+        count -= localCount;
+        iResult += localCount;
+    }
+    return iResult;
+}
+
+uint32_t Database::getPcr(DataSource source, time_t startTime, uint32_t count,
+                          std::vector<float>& values, std::vector<uint32_t>& offsets)
+{
+    values.clear();
+    offsets.clear();
+    if (!isStored(source))
+        return 0;
+
+    uint32_t iResult = 0;
+    while (count > 0)
+    {
+        sqlite3* db = beginRead(LOCK_SITE_GET_PCR);
+        if (!db)
+            break;
+        uint32_t localCount = internalGetPcr(source, startTime, std::min(count, m_atomicDumpSize), values, offsets, db);
+        endRead(db);
+        if (localCount == 0)
+            break;
+        count -= localCount;
+        iResult += localCount;
+    }
+    return iResult;
+}
+
+// false when the database could not be reopened after the swap
+bool Database::clear()
+{
+    beginWrite(LOCK_SITE_CLEAR);
+    if (!swapInEmptyDb() && m_pDb)
+        clearTables();
+    bool bResult = (m_pDb != NULL);
+    loadPartitions();
+    loadOpenChunk();
+    updateAllCounters();
+    endWrite();
+    return bResult;
+}
+
+// the slow path: the tables are dropped in the live file
+void Database::clearTables()
+{
+    std::stringstream ss;
+    // the partition files are detached outside of the transaction
+    while (!m_partitions.empty())
+        dropPartition(m_partitions.back());
+    sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        ss << "DROP TABLE IF EXISTS " << getChunkTableName(DS) << ";";
+        sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+        ss.str("");
+        ss << "DROP TABLE IF EXISTS " << getTableName(DS) << ";";
+
+        SQLiteRequest req(m_pDb, ss.str());
+        sqlite3_step(req.pStmt); // 
+
+        ss.str("");
+    }
+    sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
+    finalizeStatements();
+    createTables();
+}
+
+int delFucnt(const std::string& buffName)
+{
+    int result = remove(buffName.c_str());
+    return result;
+}
+
+// a copy of the template replaces the live files, which are renamed away and deleted in the background:
+// the time doesn't depend on the size of the database. False when the live files are unchanged
+bool Database::swapInEmptyDb()
+{
+    // a backup between its steps reads the live file, it must not be closed under it
+    if (m_backups > 0 || !m_pDb)
+        return false;
+
+    std::string newFileName = m_dbFileName + ".new";
+    {
+        std::ifstream in(m_dbEmptyFileName, std::ios::binary);
+        std::ofstream out(newFileName, std::ios::binary | std::ios::trunc);
+        bool copied = in && out && (out << in.rdbuf()) && out.flush();
+        if (!copied)
+        {
+            out.close();
+            delFucnt(newFileName);
+            return false;
+        }
+    }
+
+    // the database first, then the files that must not survive next to the new one
+    std::vector<std::string> files;
+    files.push_back(m_dbFileName);
+    files.push_back(m_dbFileName + "-wal");
+    files.push_back(m_dbFileName + "-shm");
+    files.push_back(m_dbFileName + "-journal");
+    if (usesPartitionFiles())
+    {
+        for (size_t i = 0; i < m_partitions.size(); i++)
+            files.push_back(getPartitionFileName(m_partitions[i]));
+    }
+
+    // the WAL is deleted, not copied back into the file
+    if (m_pDb && m_options.wal)
+        sqlite3_db_config(m_pDb, SQLITE_DBCONFIG_NO_CKPT_ON_CLOSE, 1, NULL);
+    if (!internalClose())
+    {
+        // still in use: the files stay where they are
+        delFucnt(newFileName);
+        if (!internalOpen(m_dbFileName, false))
+            internalClose();
+        return false;
+    }
+
+    m_clears++;
+    std::vector<std::string> deleted;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        std::stringstream ss;
+        ss << files[i] << ".del" << m_clears;
+        std::string deletedName = ss.str();
+        // left by a run that has stopped before its deletions
+        delFucnt(deletedName);
+        if (rename(files[i].c_str(), deletedName.c_str()) == 0)
+            deleted.push_back(deletedName);
+        else if (i == 0)
+        {
+            // the file is kept (open in another process on Windows)
+            delFucnt(newFileName);
+            if (!internalOpen(m_dbFileName, false))
+                internalClose();
+            return false;
+        }
+        else
+            delFucnt(files[i]);     // mostly absent
+    }
+    bool swapped = (rename(newFileName.c_str(), m_dbFileName.c_str()) == 0);
+    if (!swapped)
+        delFucnt(newFileName);
+    // a failed reopen leaves the database closed (m_pDb NULL), reported by clear()
+    if (!internalOpen(m_dbFileName, false))
+        internalClose();
+    else if (!swapped)
+        createTables();
+    m_tasks.submit("file deletion", TASK_NORMAL, [deleted](PoolTask&)
+    {
+        for (size_t i = 0; i < deleted.size(); i++)
+            delFucnt(deleted[i]);
+    });
+    return true;
+}
+
+bool Database::dump(const std::string& fileName, const DumpOptions& options)
+{
+    return runDump(fileName, options, NULL);
+}
+
+std::shared_ptr<DumpJob> Database::startDump(const std::string& fileName, const DumpOptions& options,
+                                             DumpCallback cb, void* userParam)
+{
+    std::shared_ptr<DumpJob> job = std::make_shared<DumpJob>(fileName, cb, userParam);
+    m_dumpJobsMutex.lock();
+    m_dumpJobs.push_back(job);
+    m_dumpJobsMutex.unlock();
+
+    std::shared_ptr<PoolTask> task = m_tasks.submit("dump", TASK_BULK, [this, job, options](PoolTask&)
+    {
+        bool result = runDump(job->getFileName(), options, job.get());
+        job->finish(result);
+
+        std::lock_guard<std::mutex> lock(m_dumpJobsMutex);
+        m_dumpJobs.erase(std::find(m_dumpJobs.begin(), m_dumpJobs.end(), job));
+        m_dumpJobsCond.notify_all();
+    });
+    // the pool is stopped (the database is being destroyed): the task will never run, the job fails now
+    if (task->isCancelled())
+    {
+        m_dumpJobsMutex.lock();
+        m_dumpJobs.erase(std::find(m_dumpJobs.begin(), m_dumpJobs.end(), job));
+        m_dumpJobsCond.notify_all();
+        m_dumpJobsMutex.unlock();
+        job->finish(false);
+    }
+    return job;
+}
+
+std::shared_future<bool> Database::dumpAsync(const std::string& fileName, const DumpOptions& options)
+{
+    return startDump(fileName, options)->getFuture();
+}
+
+void Database::cancelDumps()
+{
+    std::unique_lock<std::mutex> lock(m_dumpJobsMutex);
+    for (size_t i = 0; i < m_dumpJobs.size(); i++)
+        m_dumpJobs[i]->cancel();
+    while (!m_dumpJobs.empty())
+        m_dumpJobsCond.wait(lock);
+}
+
+bool Database::runDump(const std::string& fileName, const DumpOptions& options, DumpJob* job)
+{
+    TokenBucket rowsBudget(options.rowsPerSec);
+    TokenBucket bytesBudget(options.bytesPerSec);
+    uint32_t chunkSize = m_atomicDumpSize;
+    // don't take more rows under the lock than the budget allows per second
+    if (rowsBudget.isLimited() && options.rowsPerSec < chunkSize)
+        chunkSize = (options.rowsPerSec >= 1) ? static_cast<uint32_t>(options.rowsPerSec) : 1;
+
+    std::ofstream fs;
+    std::string logName = "dumpLog.csv";
+    fs.open(logName);
+    fs << "get\n"; // << "fwrite, " << "summ, " << "result, \n";
+    double result = 0;
+    Timer timer;
+    DumpWriter writer;
+    bool binary = (options.format == DUMP_FORMAT_BINARY);
+    if (!writer.open(fileName, options.compression, options.compressThreads, options.blockSize, -1, !binary))
+        return false;
+
+    char buffer[512];
+    uint32_t numBytes;
+
+    // create and write header
+    numBytes = binary ? createLogHeaderBinary(buffer, sizeof(buffer)) : createLogHeaderCSV(buffer, sizeof(buffer));
+    if (numBytes == 0)
+        return false;
+
+    writer.write(buffer, numBytes);
+
+    std::vector<LogSample> samples(m_atomicDumpSize);
+    int cnt = 0;
+    bool flag = true;
+    time_t nextTimeStamp = getStartTime(options.stream);// +100 * m_atomicDumpSize;
+    if (job)
+        job->setTotal(getTotalSamples(options.stream));
+    int j = 0;
+    do
+    {
+        double summ = 0;
+        waitForIngest(options, job);
+        if (job && job->isCancelled())
+        {
+            // nothing is held between the chunks: drop the partial output and leave
+            writer.close();
+            remove(fileName.c_str());
+            return false;
+        }
+        rowsBudget.consume(chunkSize);
+        timer.start();
+        cnt = internalGet(options.stream, &samples[0], chunkSize, nextTimeStamp);
+        double getTime = timer.stop();
+        fs << getTime << "\n";
+        uint64_t bytesBefore = writer.getBytesWritten();
+        for (uint32_t i = 0; i < cnt; i++)
+        {
+            time_t entryTime = (nextTimeStamp - cnt) + i;
+            numBytes = binary ? createLogEntryBinary(buffer, sizeof(buffer), entryTime, samples[i])
+                              : createLogEntryCSV(buffer, sizeof(buffer), entryTime, samples[i]);
+            if (numBytes == 0 || !writer.write(buffer, numBytes))
+                return false;
+        }  
+        // the budget is spent on the bytes that really reach the disk
+        bytesBudget.consume(static_cast<double>(writer.getBytesWritten() - bytesBefore));
+        if (job)
+            job->addProgress(cnt, writer.getBytesWritten());
+        j++;
+    } while (cnt > 0);
+    fs.close();
+    bool iResult = writer.close();
+    if (job)
+        job->addProgress(0, writer.getBytesWritten());
+    return iResult;
+}
+
+
+bool Database::import(const std::string& fileName)
+{
+    DumpReader reader;
+    if (!reader.open(fileName))
+        return false;
+
+    char header[dumpBinaryHeaderSize];
+    bool binary = (reader.peek(header, sizeof(header)) == sizeof(header)) &&
+                  (memcmp(header, dumpBinaryMagic, sizeof(dumpBinaryMagic)) == 0);
+    const char* line;
+    uint32_t length;
+    if (binary)
+    {
+        uint32_t recordSize, flags;
+        reader.read(header, sizeof(header));
+        getUint32(getUint32(header + sizeof(dumpBinaryMagic), recordSize), flags);
+        if (recordSize != dumpBinaryRecordSize || flags != dumpBinaryFlags)
+            return false;
+    }
+    else if (!reader.readLine(line, length)) // CSV header
+        return false;
+
+    // the whole restore goes without fsync, the retention is applied once at the end
+    beginWrite(LOCK_SITE_IMPORT);
+    int synchronous = -1;
+    {
+        SQLiteRequest req(m_pDb, "PRAGMA synchronous");
+        if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+            synchronous = sqlite3_column_int(req.pStmt, 0);
+    }
+    sqlite3_exec(m_pDb, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    endWrite();
+
+    std::vector<LogSample> samples(importBatchSize);
+    time_t batchTime = 0;
+    uint32_t count = 0;
+    bool iResult = true;
+    while (true)
+    {
+        time_t entryTime;
+        LogSample& sample = samples[count];
+        bool entry;
+        if (binary)
+        {
+            char record[dumpBinaryRecordSize];
+            entry = reader.read(record, sizeof(record)) && parseLogEntryBinary(record, entryTime, sample);
+        }
+        else
+        {
+            entry = reader.readLine(line, length);
+            // skip empty lines, stop on a broken one
+            if (entry && length == 0)
+                continue;
+            if (entry && !parseLogEntryCSV(line, length, entryTime, sample))
+            {
+                iResult = false;
+                entry = false;
+            }
+        }
+
+        // the batch must be contiguous in time: flush it before a gap
+        bool gap = entry && (count > 0) && (entryTime != batchTime + count);
+        if (count > 0 && (!entry || gap))
+        {
+            beginWrite(LOCK_SITE_IMPORT);
+            insertBulk(batchTime, &samples[0], count);
+            updateCounters(0);
+            endWrite();
+            if (gap)
+                samples[0] = sample;
+            count = 0;
+        }
+        if (!entry)
+            break;
+
+        if (count == 0)
+            batchTime = entryTime;
+        if (++count == importBatchSize)
+        {
+            beginWrite(LOCK_SITE_IMPORT);
+            insertBulk(batchTime, &samples[0], count);
+            updateCounters(0);
+            endWrite();
+            count = 0;
+        }
+    }
+
+    beginWrite(LOCK_SITE_IMPORT);
+    if (m_options.storage == STORAGE_CHUNKED)
+    {
+        saveOpenChunk();
+        applyChunkRetention();
+    }
+    else
+    {
+        uint32_t total = internalGetTotalSamples(0);
+        if (total > m_limit)
+            deleteFirstNSamples(0, total - m_limit);
+    }
+    if (synchronous >= 0)
+    {
+        std::stringstream ss;
+        ss << "PRAGMA synchronous = " << synchronous;
+        sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+    }
+    updateCounters(0);
+    endWrite();
+    return iResult && !reader.isFailed();
+}
+
+// one transaction and one prepared statement per table for the whole batch,
+// the retention is left to the caller
+void Database::insertBulk(time_t startTime, const LogSample* samples, uint32_t count)
+{
+    if (m_options.storage == STORAGE_CHUNKED)
+    {
+        addChunked(startTime, samples, count);
+        return;
+    }
+
+    sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+
+        bool input = (i < DS_IN_TOTAL);
+        uint16_t halves[maxSamples];
+        uint16_t* pHalves = (m_options.pcrPrecision == PCR_FLOAT16) ? halves : NULL;
+        for (uint32_t j = 0; j < count; j++)
+        {
+            usePartition(startTime + j);
+            CachedRequest req(getStatement(STMT_INSERT + DS));
+            const void* data = getSample(samples[j], DS);
+            if (input)
+                bindInput(req.pStmt, 0, static_cast<const InputData*>(data), startTime + j, pHalves);
+            else
+                bindOutput(req.pStmt, 0, static_cast<const OutputData*>(data), startTime + j, pHalves);
+            sqlite3_step(req.pStmt);
+        }
+    }
+    sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
+}
+
+// samples go to the open chunk, a finished chunk is saved as one row per channel;
+// the time only goes forward, older samples are skipped
+// returns the number of samples not newer than the last one, they are not stored
+uint32_t Database::addChunked(time_t startTime, const LogSample* samples, uint32_t count)
+{
+    ChannelBlock& first = m_openChunk[m_refSource];
+    uint32_t rejected = 0;
+    for (uint32_t j = 0; j < count; j++)
+    {
+        time_t currTime = startTime + j;
+        if (!first.empty() && currTime <= first.time.back())
+        {
+            rejected++;
+            continue;
+        }
+
+        time_t chunkTime = currTime - currTime % m_options.chunkSeconds;
+        if (!first.empty() && chunkTime != m_openChunkTime)
+        {
+            saveOpenChunk();
+            for (uint32_t i = 0; i < DS_COUNT; i++)
+                m_openChunk[i].clear();
+            m_openChunkSaved = 0;
+        }
+        if (first.empty())
+            m_openChunkTime = chunkTime;
+
+        for (uint32_t i = 0; i < DS_COUNT; i++)
+        {
+            DataSource DS = static_cast<DataSource>(i);
+            if (!isStored(DS))
+                continue;
+            if (i < DS_IN_TOTAL)
+                m_openChunk[i].append(currTime, *static_cast<const InputData*>(getSample(samples[j], DS)));
+            else
+                m_openChunk[i].append(currTime, *static_cast<const OutputData*>(getSample(samples[j], DS)));
+        }
+    }
+
+    // bound the loss on a crash: the open chunk is rewritten from time to time
+    if (first.size() >= m_openChunkSaved + m_options.chunkFlushSeconds)
+        saveOpenChunk();
+    m_rejectedSamples += rejected;
+    return rejected;
+}
+
+void Database::saveOpenChunk()
+{
+    if (m_openChunk[m_refSource].size() == m_openChunkSaved)
+        return;
+
+    // a part of the group commit when the ingest writer has the transaction open
+    bool transaction = (sqlite3_get_autocommit(m_pDb) != 0);
+    if (transaction)
+        execStatement(STMT_BEGIN);
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+
+        writeChunk(DS, m_openChunkTime, m_openChunk[i]);
+    }
+    if (transaction)
+        execStatement(STMT_COMMIT);
+    m_blockCache.erase(m_openChunkTime);
+    m_openChunkSaved = m_openChunk[m_refSource].size();
+}
+
+// prepared on the first use, the SQL text is built only then
+sqlite3_stmt* Database::getStatement(uint32_t id)
+{
+    if (m_statements[id] || !m_pDb)
+        return m_statements[id];
+
+    std::stringstream ss;
+    if (id == STMT_BEGIN)
+        ss << "BEGIN TRANSACTION";
+    else if (id == STMT_COMMIT)
+        ss << "COMMIT TRANSACTION";
+    else if (id == STMT_COUNT_ROWS)
+        ss << "SELECT COUNT(*), MIN(time) FROM "
+           << (isPartitioned() ? getPartitionTable(m_refSource, m_insertPartition) : getTableName(m_refSource))
+           << " WHERE stream = ?1";
+    else if (id == STMT_FIRST_CHUNK)
+        ss << "SELECT chunkTime, count FROM " << getChunkTableName(m_refSource)
+           << " WHERE chunkTime != ?1 ORDER BY chunkTime LIMIT 1";
+    else if (id == STMT_START_ROWS)
+        ss << "SELECT MIN(time) as time FROM " << getTableName(m_refSource) << " WHERE stream = ?1";
+    else if (id == STMT_START_CHUNKS)
+        ss << "SELECT MIN(startTime) FROM " << getChunkTableName(m_refSource);
+    else if (id < STMT_DELETE_FIRST)
+    {
+        DataSource DS = static_cast<DataSource>(id - STMT_INSERT);
+        std::string table = isPartitioned() ? getPartitionTable(DS, m_insertPartition) : getTableName(DS);
+        if (DS < DS_IN_TOTAL)
+            ss << "INSERT INTO " << table << "(delayFactor, mediaLossRate, rate, pcrArray,\
+										samples, time, stream)  VALUES(?,?,?,?,?,?,?);";
+        else
+            ss << "INSERT INTO " << table << "(delayFactor, rate, pcrArray,\
+										samples, time, stream)  VALUES(?,?,?,?,?,?);";
+    }
+    else if (id < STMT_COUNT_CHUNKS)
+    {
+        DataSource DS = static_cast<DataSource>(id - STMT_DELETE_FIRST);
+        // a range of the (stream, time) index: no temporary table of the rowids to delete
+        std::string table = getTableName(DS);
+        ss << "DELETE FROM " << table << " WHERE stream = ?2 AND time > 0 AND time <= COALESCE((SELECT time FROM "
+           << table << " WHERE stream = ?2 AND time > 0 ORDER BY time LIMIT 1 OFFSET ?1 - 1), (SELECT MAX(time) FROM "
+           << table << " WHERE stream = ?2))";
+    }
+    else if (id < STMT_WRITE_CHUNK)
+    {
+        DataSource DS = static_cast<DataSource>(id - STMT_COUNT_CHUNKS);
+        ss << "SELECT SUM(count) FROM " << getChunkTableName(DS) << " WHERE chunkTime != ?1";
+    }
+    else if (id < STMT_DELETE_CHUNK)
+    {
+        DataSource DS = static_cast<DataSource>(id - STMT_WRITE_CHUNK);
+        ss << "INSERT OR REPLACE INTO " << getChunkTableName(DS) << "(chunkTime, startTime, endTime,\
+										count, data, minDelayFactor, maxDelayFactor, minRate, maxRate,\
+										maxMediaLossRate, sumMediaLossRate, lossSeconds)\
+										VALUES(?,?,?,?,?,?,?,?,?,?,?,?);";
+    }
+    else
+    {
+        DataSource DS = static_cast<DataSource>(id - STMT_DELETE_CHUNK);
+        ss << "DELETE FROM " << getChunkTableName(DS) << " WHERE chunkTime = ?1";
+    }
+
+    sqlite3_prepare_v3(m_pDb, ss.str().c_str(), -1, SQLITE_PREPARE_PERSISTENT, &m_statements[id], NULL);
+    return m_statements[id];
+}
+
+void Database::execStatement(uint32_t id)
+{
+    CachedRequest req(getStatement(id));
+    sqlite3_step(req.pStmt);
+}
+
+void Database::finalizeStatements()
+{
+    for (uint32_t i = 0; i < STMT_TOTAL; i++)
+    {
+        sqlite3_finalize(m_statements[i]);
+        m_statements[i] = NULL;
+    }
+    for (uint32_t i = 0; i <= DS_COUNT; i++)
+    {
+        sqlite3_finalize(m_prevStatements[i]);
+        m_prevStatements[i] = NULL;
+    }
+    m_insertPartition = -1;
+    m_prevPartition = -1;
+}
+
+// encoded block with its zone map, replaces the chunk
+void Database::writeChunk(DataSource source, time_t chunkTime, const ChannelBlock& block)
+{
+    if (block.empty())
+        return;
+
+    std::vector<uint8_t>& data = m_chunkData;
+    data.clear();
+    block.encode(data, m_options.pcrPrecision == PCR_FLOAT16);
+    BlockSummary summary;
+    block.summarize(summary);
+
+    CachedRequest req(getStatement(STMT_WRITE_CHUNK + source));
+    sqlite3_bind_int64(req.pStmt, 1, chunkTime);
+    sqlite3_bind_int64(req.pStmt, 2, block.time.front());
+    sqlite3_bind_int64(req.pStmt, 3, block.time.back());
+    sqlite3_bind_int(req.pStmt, 4, block.size());
+    sqlite3_bind_blob(req.pStmt, 5, &data[0], data.size(), NULL);
+    sqlite3_bind_double(req.pStmt, 6, summary.minDelayFactor);
+    sqlite3_bind_double(req.pStmt, 7, summary.maxDelayFactor);
+    sqlite3_bind_int64(req.pStmt, 8, summary.minRate);
+    sqlite3_bind_int64(req.pStmt, 9, summary.maxRate);
+    sqlite3_bind_int64(req.pStmt, 10, summary.maxMediaLossRate);
+    sqlite3_bind_int64(req.pStmt, 11, summary.sumMediaLossRate);
+    sqlite3_bind_int64(req.pStmt, 12, summary.lossSeconds);
+    sqlite3_step(req.pStmt);
+}
+
+// continue the newest saved chunk after the restart
+void Database::loadOpenChunk()
+{
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+        m_openChunk[i].clear();
+    m_openChunkTime = 0;
+    m_openChunkSaved = 0;
+    m_blockCache.clear();
+    if (m_options.storage != STORAGE_CHUNKED)
+    {
+        // rows compacted by an earlier run stay readable with the compaction off
+        m_compacted = (m_options.compactAfterSeconds > 0);
+        if (!m_compacted && m_pDb)
+        {
+            SQLiteRequest req(m_pDb, "SELECT 1 FROM " + getChunkTableName(m_refSource) + " LIMIT 1");
+            m_compacted = (sqlite3_step(req.pStmt) == SQLITE_ROW);
+        }
+        return;
+    }
+
+    SQLiteRequest req(m_pDb, "SELECT MAX(chunkTime) FROM " + getChunkTableName(m_refSource));
+    if (sqlite3_step(req.pStmt) != SQLITE_ROW || sqlite3_column_type(req.pStmt, 0) == SQLITE_NULL)
+        return;
+    time_t chunkTime = sqlite3_column_int64(req.pStmt, 0);
+
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+        std::shared_ptr<const ChannelBlock> block = readChunk(DS, chunkTime);
+        if (!block)
+        {
+            for (uint32_t j = 0; j < DS_COUNT; j++)
+                m_openChunk[j].clear();
+            return;
+        }
+        m_openChunk[i] = *block;
+    }
+    m_openChunkTime = chunkTime;
+    m_openChunkSaved = m_openChunk[m_refSource].size();
+}
+
+// decoded chunk (NULL if there is none), the recently read ones come from the cache
+std::shared_ptr<const ChannelBlock> Database::readChunk(DataSource source, time_t chunkTime, sqlite3* db)
+{
+    std::shared_ptr<const ChannelBlock> cached = m_blockCache.find(source, chunkTime);
+    if (cached)
+        return cached;
+
+    std::stringstream ss;
+    ss << "SELECT data FROM " << getChunkTableName(source) << " WHERE chunkTime = " << chunkTime;
+    SQLiteRequest req(db ? db : m_pDb, ss.str());
+    if (sqlite3_step(req.pStmt) != SQLITE_ROW)
+        return std::shared_ptr<const ChannelBlock>();
+
+    std::shared_ptr<ChannelBlock> block = std::make_shared<ChannelBlock>(source < DS_IN_TOTAL);
+    const uint8_t* data = static_cast<const uint8_t*>(sqlite3_column_blob(req.pStmt, 0));
+    if (!block->decode(data, sqlite3_column_bytes(req.pStmt, 0)))
+        return std::shared_ptr<const ChannelBlock>();
+    m_blockCache.insert(source, chunkTime, block);
+    return block;
+}
+
+// saved chunk with the first sample at or after startTime, false = the open chunk
+bool Database::findChunk(time_t startTime, time_t& chunkTime, sqlite3* db)
+{
+    // saved chunks are older than the open one
+    std::stringstream ss;
+    ss << "SELECT chunkTime FROM " << getChunkTableName(m_refSource) << " WHERE chunkTime > " << startTime - m_options.chunkSeconds
+       << " AND endTime >= " << startTime << " AND chunkTime != " << m_openChunkTime
+       << " ORDER BY chunkTime LIMIT 1";
+    SQLiteRequest req(db, ss.str());
+    if (sqlite3_step(req.pStmt) != SQLITE_ROW)
+        return false;
+    chunkTime = sqlite3_column_int64(req.pStmt, 0);
+    return true;
+}
+
+// contiguous run of samples from the first one at or after startTime, inside one chunk
+uint32_t Database::internalGetChunked(LogSample* samples, uint32_t count, time_t& startTime, sqlite3* db)
+{
+    std::shared_ptr<const ChannelBlock> chunk[DS_COUNT];
+    const ChannelBlock* blocks[DS_COUNT];
+    time_t chunkTime;
+    bool saved = findChunk(startTime, chunkTime, db);
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        blocks[i] = &m_openChunk[i];
+        if (saved && isStored(DS))
+        {
+            chunk[i] = readChunk(DS, chunkTime, db);
+            if (!chunk[i])
+                return 0;
+            blocks[i] = chunk[i].get();
+        }
+    }
+
+    const ChannelBlock& first = *blocks[m_refSource];
+    uint32_t index = first.findTime(startTime);
+    if (index == first.size())
+        return 0;
+
+    time_t firstTime = first.time[index];
+    uint32_t iResult = 0;
+    while (index + iResult < first.size() && iResult < count && first.time[index + iResult] == firstTime + iResult)
+        iResult++;
+
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+
+        const ChannelBlock& block = *blocks[i];
+        if (block.size() != first.size())
+            return 0;
+        uint32_t pcrOffset = block.getPcrOffset(index);
+        for (uint32_t k = 0; k < iResult; k++)
+        {
+            if (i < DS_IN_TOTAL)
+                block.get(index + k, *static_cast<InputData*>(getSample(samples[k], DS)), pcrOffset);
+            else
+                block.get(index + k, *static_cast<OutputData*>(getSample(samples[k], DS)), pcrOffset);
+        }
+    }
+
+    startTime = firstTime + iResult;
+    return iResult;
+}
+
+// PCR values of a contiguous run of seconds, inside one chunk or one query
+uint32_t Database::internalGetPcr(DataSource source, time_t& startTime, uint32_t count,
+                                  std::vector<float>& values, std::vector<uint32_t>& offsets, sqlite3* db)
+{
+    uint32_t iResult = 0;
+    time_t chunkTime;
+    bool saved = usesChunks() && findChunk(startTime, chunkTime, db);
+    if (m_options.storage == STORAGE_CHUNKED || saved)
+    {
+        std::shared_ptr<const ChannelBlock> chunk;
+        const ChannelBlock* block = &m_openChunk[source];
+        if (saved)
+        {
+            chunk = readChunk(source, chunkTime, db);
+            if (!chunk)
+                return 0;
+            block = chunk.get();
+        }
+
+        uint32_t index = block->findTime(startTime);
+        if (index == block->size())
+            return 0;
+        time_t firstTime = block->time[index];
+        while (index + iResult < block->size() && iResult < count && block->time[index + iResult] == firstTime + iResult)
+            iResult++;
+
+        block->getPcr(index, iResult, values, offsets);
+        startTime = firstTime + iResult;
+        return iResult;
+    }
+
+    time_t firstTime = 0;
+    bool broken = false;
+    // the partition files are read a group at a time from the first one with rows,
+    // the run goes on in the next group when it reaches the end of this one
+    forEachPartitionGroup(db, startTime, endOfTime, [&](time_t groupStart, time_t groupEnd)
+    {
+        std::stringstream ss;
+        ss << "SELECT time, samples, pcrArray FROM " << getRowSource(source, groupStart, groupEnd)
+           << " WHERE stream = 0 AND time >= " << (iResult ? firstTime + iResult : startTime)
+           << " LIMIT " << count - iResult;
+        SQLiteRequest req(db, ss.str());
+
+        while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+        {
+            time_t currTime = sqlite3_column_int64(req.pStmt, 0);
+            if (iResult == 0)
+                firstTime = currTime;
+            else if (currTime != firstTime + iResult)
+            {
+                broken = true;
+                break;
+            }
+
+            uint8_t samples = std::min<uint8_t>(sqlite3_column_int(req.pStmt, 1), maxSamples);
+            offsets.push_back(static_cast<uint32_t>(values.size()));
+            values.resize(values.size() + samples);
+            if (samples)
+                readPcr(req.pStmt, 2, &values[values.size() - samples], samples);
+            iResult++;
+        }
+        return iResult == 0 || (!broken && iResult < count && firstTime + iResult > groupEnd);
+    });
+    startTime = firstTime + iResult;
+    return iResult;
+}
+
+// chunked storage, or rows compacted into the chunk tables: otherwise the chunk tables are not queried
+bool Database::usesChunks() const
+{
+    return m_options.storage == STORAGE_CHUNKED || m_compacted;
+}
+
+uint32_t Database::getChunkedTotalSamples(DataSource source)
+{
+    // the open chunk may have more samples than its saved copy
+    CachedRequest req(getStatement(STMT_COUNT_CHUNKS + source));
+    sqlite3_bind_int64(req.pStmt, 1, m_openChunkTime);
+    uint32_t totalSamples = 0;
+    if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+        totalSamples = sqlite3_column_int(req.pStmt, 0);
+    return totalSamples + m_openChunk[source].size();
+}
+
+void Database::scheduleRetention()
+{
+    // merged into the pending run, it trims to the limit of its time
+    m_tasks.submit(m_retentionTask);
+}
+
+// row storage trims a stream to the limit in one batch once it is over it (before the compaction
+// it deleted one row per write); the compacted rows and the chunks go a whole chunk at a time
+void Database::applyRetention()
+{
+    beginWrite(LOCK_SITE_RETENTION);
+    // every stream may have lost rows with the partitions
+    if (m_pDb && isPartitioned() && applyPartitionRetention())
+        updateAllCounters();
+    for (uint32_t i = 0; m_pDb && i < m_options.maxStreams; i++)
+    {
+        if (m_totalSamples[i] <= m_limit)
+            continue;
+        if (i == 0 && m_options.storage == STORAGE_CHUNKED)
+            applyChunkRetention();
+        else if (isPartitioned())
+        {
+            // only the compacted rows (older than the partitions) are deleted by count
+            if (i != 0 || !usesChunks() || getChunkedTotalSamples(m_refSource) == 0)
+                continue;
+            uint32_t total = internalGetTotalSamples(i);
+            if (total > m_limit)
+                deleteFirstChunks(total - m_limit);
+        }
+        else
+        {
+            uint32_t total = internalGetTotalSamples(i);
+            if (total > m_limit)
+                deleteFirstNSamples(i, total - m_limit);
+        }
+        updateCounters(i);
+    }
+    endWrite();
+}
+
+bool Database::isPartitioned() const
+{
+    return m_options.partitionSeconds > 0;
+}
+
+bool Database::usesPartitionFiles() const
+{
+    return isPartitioned() && m_options.partitionFiles;
+}
+
+// a table of the partition, in its own file it is reached through the attached schema
+std::string Database::getPartitionTable(DataSource source, time_t partitionTime) const
+{
+    if (!usesPartitionFiles())
+        return getPartitionName(source, partitionTime);
+    return getPartitionSchema(partitionTime) + "." + getTableName(source);
+}
+
+// "name.db" -> "name_1600000000.db"
+std::string Database::getPartitionFileName(time_t partitionTime) const
+{
+    std::string fileName = m_dbFileName;
+    if (fileName.size() > 3 && fileName.compare(fileName.size() - 3, 3, ".db") == 0)
+        fileName.erase(fileName.size() - 3, 3);
+    std::stringstream ss;
+    ss << fileName << "_" << partitionTime << ".db";
+    return ss.str();
+}
+
+// false when it was attached already (the insert partition of the writer) or could not be attached
+bool Database::attachPartition(sqlite3* db, time_t partitionTime)
+{
+    std::string schema = getPartitionSchema(partitionTime);
+    if (sqlite3_db_filename(db, schema.c_str()))
+        return false;
+    std::string fileName = getPartitionFileName(partitionTime);
+    SQLiteRequest req(db, "ATTACH DATABASE ?1 AS " + schema);
+    sqlite3_bind_text(req.pStmt, 1, fileName.c_str(), -1, SQLITE_TRANSIENT);
+    return sqlite3_step(req.pStmt) == SQLITE_DONE;
+}
+
+void Database::detachPartition(sqlite3* db, time_t partitionTime)
+{
+    std::string request = "DETACH DATABASE " + getPartitionSchema(partitionTime);
+    sqlite3_exec(db, request.c_str(), NULL, NULL, NULL);
+}
+
+// the partition files holding [startTime, endTime] are attached to db a group at a time, oldest first,
+// and fn reads the range of the group (false stops); without them fn gets the whole range.
+// ATTACH is not allowed in a transaction
+bool Database::forEachPartitionGroup(sqlite3* db, time_t startTime, time_t endTime,
+                                     const std::function<bool(time_t, time_t)>& fn)
+{
+    if (!usesPartitionFiles())
+        return fn(startTime, endTime);
+    time_t span = static_cast<time_t>(m_options.partitionSeconds);
+    std::vector<time_t> partitions;
+    for (size_t i = 0; i < m_partitions.size(); i++)
+    {
+        if (m_partitions[i] <= endTime && m_partitions[i] + span > startTime)
+            partitions.push_back(m_partitions[i]);
+    }
+    if (partitions.empty())
+        return fn(startTime, endTime);
+
+    for (size_t i = 0; i < partitions.size(); i += partitionsPerQuery)
+    {
+        size_t end = std::min(partitions.size(), i + partitionsPerQuery);
+        std::vector<time_t> attached;
+        for (size_t j = i; j < end; j++)
+        {
+            if (attachPartition(db, partitions[j]))
+                attached.push_back(partitions[j]);
+        }
+        bool more = fn(std::max(startTime, partitions[i]), std::min(endTime, partitions[end - 1] + span - 1));
+        for (size_t j = 0; j < attached.size(); j++)
+            detachPartition(db, attached[j]);
+        if (!more)
+            return false;
+    }
+    return true;
+}
+
+// start times of the partitions in the file, oldest first
+std::vector<time_t> Database::findPartitions()
+{
+    std::vector<time_t> partitions;
+    if (usesPartitionFiles())
+    {
+        partitions = findPartitionFiles();
+        std::sort(partitions.begin(), partitions.end());
+        return partitions;
+    }
+    std::string prefix = getPartitionPrefix(m_refSource);
+    SQLiteRequest req(m_pDb, "SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB '" + prefix + "[0-9]*'");
+    while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+    {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(req.pStmt, 0));
+        partitions.push_back(static_cast<time_t>(atoll(name + prefix.size())));
+    }
+    std::sort(partitions.begin(), partitions.end());
+    return partitions;
+}
+
+// the partition files are listed by the directory, no table of the main file is written for them:
+// "name_<digits>.db" next to it, the ones renamed for their deletion don't match
+std::vector<time_t> Database::findPartitionFiles() const
+{
+    std::string pattern = getPartitionFileName(0);
+    std::string prefix = pattern.substr(0, pattern.size() - strlen("0.db"));
+    std::string dir = ".";
+    size_t slash = prefix.find_last_of("/\\");
+    if (slash != std::string::npos)
+    {
+        dir = prefix.substr(0, slash);
+        prefix.erase(0, slash + 1);
+    }
+
+    std::vector<std::string> names;
+#ifdef OS_WINDOWS
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\" + prefix + "*.db").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+            names.push_back(data.cFileName);
+        while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR* pDir = opendir(dir.c_str());
+    if (pDir)
+    {
+        while (struct dirent* entry = readdir(pDir))
+            names.push_back(entry->d_name);
+        closedir(pDir);
+    }
+#endif
+
+    std::vector<time_t> partitions;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const std::string& name = names[i];
+        size_t end = name.size() - strlen(".db");
+        if (name.size() <= prefix.size() + strlen(".db") || name.compare(0, prefix.size(), prefix) != 0
+            || name.compare(end, std::string::npos, ".db") != 0)
+            continue;
+        std::string digits = name.substr(prefix.size(), end - prefix.size());
+        if (digits.find_first_not_of("0123456789") == std::string::npos)
+            partitions.push_back(static_cast<time_t>(atoll(digits.c_str())));
+    }
+    return partitions;
+}
+
+// the partitions of the file; the rows of a file written without them are moved to them
+void Database::loadPartitions()
+{
+    releasePrevPartition();
+    resetRowStatements();
+    m_partitions.clear();
+    m_partitionRows.clear();
+    m_insertPartition = -1;
+    m_newestTime = 0;
+    if (!m_pDb || !isPartitioned())
+        return;
+    m_partitions = findPartitions();
+
+    std::vector<time_t> moved;
+    {
+        std::stringstream ss;
+        ss << "SELECT DISTINCT time - time % " << m_options.partitionSeconds << " FROM " << getTableName(m_refSource);
+        SQLiteRequest req(m_pDb, ss.str());
+        while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+            moved.push_back(sqlite3_column_int64(req.pStmt, 0));
+    }
+    std::stringstream ss;
+    for (size_t i = 0; i < moved.size(); i++)
+    {
+        bool attached = usesPartitionFiles() && attachPartition(m_pDb, moved[i]);
+        if (!std::binary_search(m_partitions.begin(), m_partitions.end(), moved[i]))
+            createPartition(moved[i]);
+        // one partition per transaction, the attached file is part of it
+        sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+        for (uint32_t j = 0; j < DS_COUNT; j++)
+        {
+            DataSource DS = static_cast<DataSource>(j);
+            if (!isStored(DS))
+                continue;
+            ss << "INSERT INTO " << getPartitionTable(DS, moved[i]) << " SELECT * FROM " << getTableName(DS)
+               << " WHERE time >= " << moved[i] << " AND time < " << moved[i] + m_options.partitionSeconds
+               << " ORDER BY rowid";
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+            ss << "DELETE FROM " << getTableName(DS) << " WHERE time >= " << moved[i] << " AND time < "
+               << moved[i] + m_options.partitionSeconds;
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+        }
+        sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
+        if (attached)
+            detachPartition(m_pDb, moved[i]);
+    }
+
+    if (!m_partitions.empty())
+    {
+        time_t partitionTime = m_partitions.back();
+        bool attached = usesPartitionFiles() && attachPartition(m_pDb, partitionTime);
+        {
+            SQLiteRequest req(m_pDb, "SELECT MAX(time) FROM " + getPartitionTable(m_refSource, partitionTime));
+            if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+                m_newestTime = sqlite3_column_int64(req.pStmt, 0);
+        }
+        if (attached)
+            detachPartition(m_pDb, partitionTime);
+    }
+}
+
+// the insert statements write to the partition of the time, created when it is new; the rows around
+// a boundary (streams interleaved in a group commit, addT per channel) go back and forth between two
+// partitions, the previous one keeps its statements and stays attached for them
+void Database::usePartition(time_t time)
+{
+    if (!isPartitioned())
+        return;
+    if (time > m_newestTime)
+        m_newestTime = time;
+    time_t partitionTime = time - time % m_options.partitionSeconds;
+    if (partitionTime == m_insertPartition)
+        return;
+    // both are counted live (countPartitionRows), the count goes with the inserts
+    if (m_insertPartition >= 0)
+        getStatement(STMT_COUNT_ROWS);
+    if (partitionTime == m_prevPartition)
+    {
+        swapPartitionStatements();
+        std::swap(m_insertPartition, m_prevPartition);
+        return;
+    }
+
+    // the writer keeps the insert partitions attached; ATTACH and DETACH are not allowed
+    // in a transaction, the rows so far are committed first
+    bool transaction = usesPartitionFiles() && !sqlite3_get_autocommit(m_pDb);
+    if (transaction)
+        execStatement(STMT_COMMIT);
+    releasePrevPartition();
+    swapPartitionStatements();
+    m_prevPartition = m_insertPartition;
+    m_insertPartition = partitionTime;
+    m_partitionRows.erase(partitionTime);
+    if (usesPartitionFiles())
+        attachPartition(m_pDb, partitionTime);
+    if (!std::binary_search(m_partitions.begin(), m_partitions.end(), partitionTime))
+        createPartition(partitionTime);
+    if (transaction)
+        execStatement(STMT_BEGIN);
+}
+
+// the statements of the insert partition and of the previous one trade places
+void Database::swapPartitionStatements()
+{
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+        std::swap(m_statements[STMT_INSERT + i], m_prevStatements[i]);
+    std::swap(m_statements[STMT_COUNT_ROWS], m_prevStatements[DS_COUNT]);
+}
+
+// the previous insert partition is closed: counted once from now on, its file detached
+// (outside of a transaction)
+void Database::releasePrevPartition()
+{
+    if (m_prevPartition < 0)
+        return;
+    for (uint32_t i = 0; i <= DS_COUNT; i++)
+    {
+        sqlite3_finalize(m_prevStatements[i]);
+        m_prevStatements[i] = NULL;
+    }
+    if (usesPartitionFiles())
+        detachPartition(m_pDb, m_prevPartition);
+    m_prevPartition = -1;
+}
+
+// the file of a partition is attached already
+void Database::createPartition(time_t partitionTime)
+{
+    std::stringstream ss;
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+        ss << "CREATE TABLE IF NOT EXISTS " << getPartitionTable(DS, partitionTime) << getRowColumns(i < DS_IN_TOTAL);
+        sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+        ss.str("");
+        if (usesPartitionFiles())
+        {
+            ss << "CREATE INDEX IF NOT EXISTS " << getPartitionSchema(partitionTime) << ".'StreamIndex" << i << "' ON "
+               << getTableName(DS) << "(stream, time)";
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+        }
+        else
+        {
+            ss << "CREATE INDEX IF NOT EXISTS '" << getPartitionPrefix(DS) << partitionTime << "StreamIndex' ON "
+               << getPartitionName(DS, partitionTime) << "(stream, time)";
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+        }
+    }
+    m_partitions.insert(std::upper_bound(m_partitions.begin(), m_partitions.end(), partitionTime), partitionTime);
+}
+
+// the whole partition at once: its pages go to the free list, no row is deleted one by one;
+// a partition file is detached, renamed away from the listing and deleted in the background:
+// no page of any database file is written
+void Database::dropPartition(time_t partitionTime)
+{
+    std::stringstream ss;
+    if (m_insertPartition == partitionTime)
+    {
+        resetRowStatements();
+        m_insertPartition = -1;
+    }
+    if (m_prevPartition == partitionTime)
+        releasePrevPartition();
+    if (usesPartitionFiles())
+    {
+        detachPartition(m_pDb, partitionTime);
+        std::string fileName = getPartitionFileName(partitionTime) + ".del";
+        // left by a run that has stopped before its deletion
+        delFucnt(fileName);
+        if (rename(getPartitionFileName(partitionTime).c_str(), fileName.c_str()) == 0)
+            m_tasks.submit("partition deletion", TASK_NORMAL, [fileName](PoolTask&) { delFucnt(fileName); });
+        else
+            delFucnt(getPartitionFileName(partitionTime));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < DS_COUNT; i++)
+        {
+            DataSource DS = static_cast<DataSource>(i);
+            if (!isStored(DS))
+                continue;
+            ss << "DROP TABLE IF EXISTS " << getPartitionName(DS, partitionTime);
+            sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+            ss.str("");
+        }
+    }
+    m_partitionRows.erase(partitionTime);
+    std::vector<time_t>::iterator it = std::lower_bound(m_partitions.begin(), m_partitions.end(), partitionTime);
+    if (it != m_partitions.end() && *it == partitionTime)
+        m_partitions.erase(it);
+}
+
+// the partitions whose rows of every stream have the limit of newer samples of the stream in the
+// other partitions, oldest first; the newest and the insert partitions stay. The rows of a partition
+// still needed by a stream (one that stopped) are kept, the expired streams are deleted from it row by row
+// so none of them has a gap: the only pages retention writes, in that partition (with one stream, never).
+// False when nothing has expired
+bool Database::applyPartitionRetention()
+{
+    if (m_partitions.size() < 2)
+        return false;
+    // rows per stream in the partitions, the compacted ones are older than all of them
+    std::vector<uint32_t> rows(m_options.maxStreams);
+    for (uint32_t i = 0; i < m_options.maxStreams; i++)
+        rows[i] = m_totalSamples[i];
+    if (usesChunks())
+        rows[0] -= std::min(rows[0], getChunkedTotalSamples(m_refSource));
+
+    // the files are detached outside of a transaction
+    bool transaction = !usesPartitionFiles();
+    bool changed = false;
+    std::vector<uint32_t> older(m_options.maxStreams); // rows of the partitions kept so far
+    std::vector<uint32_t> counts(m_options.maxStreams);
+    std::vector<bool> expired(m_options.maxStreams);
+    for (size_t j = 0; j + 1 < m_partitions.size(); )
+    {
+        time_t partitionTime = m_partitions[j];
+        bool live = (partitionTime == m_insertPartition || partitionTime == m_prevPartition);
+        bool partitionExpired = true;
+        bool streamExpired = false;
+        for (uint32_t i = 0; i < m_options.maxStreams; i++)
+        {
+            time_t startTime;
+            countPartitionRows(partitionTime, i, counts[i], startTime);
+            expired[i] = (!live && counts[i] > 0 && rows[i] >= older[i] + counts[i] + m_limit);
+            partitionExpired = partitionExpired && (counts[i] == 0 || expired[i]);
+            streamExpired = streamExpired || expired[i];
+        }
+        if (!streamExpired)
+        {
+            for (uint32_t i = 0; i < m_options.maxStreams; i++)
+                older[i] += counts[i];
+            j++;
+            continue;
+        }
+        if (transaction && !changed)
+            execStatement(STMT_BEGIN);
+        changed = true;
+        if (partitionExpired)
+        {
+            for (uint32_t i = 0; i < m_options.maxStreams; i++)
+                rows[i] -= counts[i];
+            dropPartition(partitionTime);
+            continue;
+        }
+        for (uint32_t i = 0; i < m_options.maxStreams; i++)
+        {
+            if (expired[i])
+            {
+                deletePartitionRows(partitionTime, i);
+                rows[i] -= counts[i];
+            }
+            else
+                older[i] += counts[i];
+        }
+        j++;
+    }
+    if (transaction && changed)
+        execStatement(STMT_COMMIT);
+    return changed;
+}
+
+// all the rows of a stream in a closed partition
+void Database::deletePartitionRows(time_t partitionTime, uint32_t stream)
+{
+    bool attached = usesPartitionFiles() && attachPartition(m_pDb, partitionTime);
+    std::stringstream ss;
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        DataSource DS = static_cast<DataSource>(i);
+        if (!isStored(DS))
+            continue;
+        ss << "DELETE FROM " << getPartitionTable(DS, partitionTime) << " WHERE stream = " << stream;
+        sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+        ss.str("");
+    }
+    if (attached)
+        detachPartition(m_pDb, partitionTime);
+    m_partitionRows.erase(partitionTime);
+}
+
+// rows of the stream in a partition and its first time (0 = none); the insert partitions are counted
+// every time (through the index), the others are counted once
+void Database::countPartitionRows(time_t partitionTime, uint32_t stream, uint32_t& count, time_t& startTime)
+{
+    count = 0;
+    startTime = 0;
+    if (partitionTime == m_insertPartition || partitionTime == m_prevPartition)
+    {
+        CachedRequest req((partitionTime == m_insertPartition) ? getStatement(STMT_COUNT_ROWS)
+                                                                : m_prevStatements[DS_COUNT]);
+        sqlite3_bind_int(req.pStmt, 1, stream);
+        if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+        {
+            count = sqlite3_column_int(req.pStmt, 0);
+            startTime = sqlite3_column_int64(req.pStmt, 1);
+        }
+        return;
+    }
+
+    std::map<time_t, PartitionRows>::iterator it = m_partitionRows.find(partitionTime);
+    if (it == m_partitionRows.end())
+    {
+        PartitionRows rows;
+        rows.count.resize(m_options.maxStreams);
+        rows.startTime.resize(m_options.maxStreams);
+        bool attached = usesPartitionFiles() && attachPartition(m_pDb, partitionTime);
+        bool counted = false;
+        {
+            SQLiteRequest req(m_pDb, "SELECT stream, COUNT(*), MIN(time) FROM "
+                              + getPartitionTable(m_refSource, partitionTime) + " GROUP BY stream");
+            while (req.pStmt && sqlite3_step(req.pStmt) == SQLITE_ROW)
+            {
+                uint32_t rowStream = sqlite3_column_int(req.pStmt, 0);
+                if (rowStream >= m_options.maxStreams)
+                    continue;
+                rows.count[rowStream] = sqlite3_column_int(req.pStmt, 1);
+                rows.startTime[rowStream] = sqlite3_column_int64(req.pStmt, 2);
+            }
+            counted = (req.pStmt != NULL);
+        }
+        if (attached)
+            detachPartition(m_pDb, partitionTime);
+        if (!counted)
+            return;
+        it = m_partitionRows.insert(std::make_pair(partitionTime, rows)).first;
+    }
+    count = it->second.count[stream];
+    startTime = it->second.startTime[stream];
+}
+
+// the statements of the insert partition are prepared again for the next one
+void Database::resetRowStatements()
+{
+    sqlite3_finalize(m_statements[STMT_COUNT_ROWS]);
+    m_statements[STMT_COUNT_ROWS] = NULL;
+    for (uint32_t i = 0; i < DS_COUNT; i++)
+    {
+        sqlite3_finalize(m_statements[STMT_INSERT + i]);
+        m_statements[STMT_INSERT + i] = NULL;
+    }
+}
+
+std::vector<std::string> Database::getRowTables(DataSource source, time_t startTime, time_t endTime) const
+{
+    std::vector<std::string> tables;
+    if (!isPartitioned())
+    {
+        tables.push_back(getTableName(source));
+        return tables;
+    }
+    for (size_t i = 0; i < m_partitions.size(); i++)
+    {
+        time_t partitionTime = m_partitions[i];
+        if (partitionTime <= endTime && partitionTime + static_cast<time_t>(m_options.partitionSeconds) > startTime)
+            tables.push_back(getPartitionTable(source, partitionTime));
+    }
+    return tables;
+}
+
+// the partitions in time order, SQLite pushes the conditions of the query down to each of them;
+// the partition files of the range have to be attached (forEachPartitionGroup)
+std::string Database::getRowSource(DataSource source, time_t startTime, time_t endTime) const
+{
+    std::vector<std::string> tables = getRowTables(source, startTime, endTime);
+    if (tables.empty())
+        return getTableName(source); // empty when partitioned
+    if (tables.size() == 1)
+        return tables[0];
+    std::stringstream ss;
+    ss << "(";
+    for (size_t i = 0; i < tables.size(); i++)
+        ss << (i ? " UNION ALL " : "") << "SELECT * FROM " << tables[i];
+    ss << ")";
+    return ss.str();
+}
+
+std::vector<TaskStats> Database::getMaintenanceStats() const
+{
+    return m_tasks.getStats();
+}
+
+std::vector<LockSiteStats> Database::getLockStats() const
+{
+    return m_lockProfiler.getStats();
+}
+
+void Database::resetLockStats()
+{
+    m_lockProfiler.reset();
+}
+
+void Database::enableLockStats(bool enable)
+{
+    m_lockProfiler.setEnabled(enable);
+}
+
+WalStats Database::getWalStats() const
+{
+    std::lock_guard<std::mutex> lock(m_walStatsMutex);
+    WalStats stats = m_walStats;
+    stats.walPages = m_walPages;
+    return stats;
+}
+
+// after every commit of the writer's connection (it holds the writer lock)
+int Database::walHook(void* param, sqlite3*, const char*, int pages)
+{
+    Database* database = static_cast<Database*>(param);
+    database->m_walPages = static_cast<uint32_t>(pages);
+    if (database->m_checkpointTask && static_cast<uint32_t>(pages) >= database->m_options.walCheckpointPages)
+        database->m_tasks.submit(database->m_checkpointTask, database->m_options.walCheckpointMs);
+    return SQLITE_OK;
+}
+
+// passive checkpoints run beside the writes. Under a steady ingest they never catch up with
+// the writer and the WAL keeps growing: a large WAL is truncated under the writer lock
+void Database::checkpointTaskFunc()
+{
+    bool truncate = (m_walPages >= m_options.walTruncatePages);
+    Timer timer(true);
+    int logFrames = 0;
+    int checkpointed = 0;
+    int errCode;
+    uint64_t frames = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        if (!m_checkpointDb)
+            return;
+        errCode = sqlite3_wal_checkpoint_v2(m_checkpointDb, NULL, SQLITE_CHECKPOINT_PASSIVE, &logFrames, &checkpointed);
+        // the count is of the whole WAL, it is smaller after the WAL has started over
+        if (checkpointed >= 0)
+        {
+            frames = checkpointed - ((static_cast<uint32_t>(checkpointed) >= m_walBackfilled) ? m_walBackfilled : 0);
+            m_walBackfilled = checkpointed;
+        }
+    }
+    if (truncate)
+    {
+        // the frames written since the passive one are left, the writers wait for them only
+        beginWrite(LOCK_SITE_CHECKPOINT);
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        if (m_checkpointDb)
+        {
+            errCode = sqlite3_wal_checkpoint_v2(m_checkpointDb, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
+            if (errCode == SQLITE_OK)
+            {
+                frames += m_walPages - std::min<uint32_t>(m_walPages, m_walBackfilled);
+                m_walPages = 0;
+                m_walBackfilled = 0;
+            }
+        }
+        endWrite();
+    }
+    double duration = timer.stop();
+
+    std::lock_guard<std::mutex> lock(m_walStatsMutex);
+    m_walStats.checkpoints++;
+    if (truncate && errCode == SQLITE_OK)
+        m_walStats.truncations++;
+    m_walStats.framesCheckpointed += frames;
+    m_walStats.lastDuration = duration;
+    m_walStats.maxDuration = std::max(m_walStats.maxDuration, duration);
+}
+
+// drop the oldest chunks while the rest still holds the limit
+void Database::applyChunkRetention()
+{
+    uint32_t total = getChunkedTotalSamples(m_refSource);
+    if (total > m_limit)
+        deleteFirstChunks(total - m_limit);
+}
+
+// drop the oldest chunks holding up to n samples, a partial chunk is kept whole;
+// returns how many of n are left (0 when a chunk is kept)
+uint32_t Database::deleteFirstChunks(uint32_t n)
+{
+    while (n > 0)
+    {
+        time_t chunkTime;
+        uint32_t chunkCount;
+        {
+            CachedRequest req(getStatement(STMT_FIRST_CHUNK));
+            sqlite3_bind_int64(req.pStmt, 1, m_openChunkTime);
+            if (sqlite3_step(req.pStmt) != SQLITE_ROW)
+                return n;
+            chunkTime = sqlite3_column_int64(req.pStmt, 0);
+            chunkCount = sqlite3_column_int(req.pStmt, 1);
+        }
+        if (chunkCount > n)
+            return 0;
+
+        execStatement(STMT_BEGIN);
+        for (uint32_t i = 0; i < DS_COUNT; i++)
+        {
+            DataSource DS = static_cast<DataSource>(i);
+            if (!isStored(DS))
+                continue;
+            CachedRequest req(getStatement(STMT_DELETE_CHUNK + DS));
+            sqlite3_bind_int64(req.pStmt, 1, chunkTime);
+            sqlite3_step(req.pStmt);
+        }
+        execStatement(STMT_COMMIT);
+        m_blockCache.erase(chunkTime);
+        n -= chunkCount;
+    }
+    return 0;
+}
+
+bool Database::enqueue(time_t time, const LogSample& sample)
+{
+    return enqueue(0, time, sample);
+}
+
+bool Database::enqueue(uint32_t stream, time_t time, const LogSample& sample)
+{
+    if (stream >= m_options.maxStreams)
+        return false;
+    if (!m_ingestQueue)
+    {
+        add(stream, time, &sample, 1);
+        return true;
+    }
+
+    IngestRecord record;
+    record.stream = stream;
+    record.time = time;
+    record.sample = sample;
+    bool result = m_ingestQueue->push(record);
+    if (m_ingestIdle)
+        m_ingestCond.notify_one();
+    return result;
+}
+
+void Database::flushIngest()
+{
+    if (!m_ingestQueue)
+        return;
+    // empty first: what was taken before is written once the writer is not busy
+    m_ingestFlushes++;
+    while (!m_ingestQueue->empty() || m_ingestBusy)
+    {
+        m_ingestCond.notify_one();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    m_ingestFlushes--;
+}
+
+uint64_t Database::getIngestWritten() const
+{
+    return m_ingestWritten;
+}
+
+uint64_t Database::getIngestDropped() const
+{
+    return m_ingestQueue ? m_ingestQueue->getDropped() : 0;
+}
+
+uint64_t Database::getRejectedSamples() const
+{
+    return m_rejectedSamples;
+}
+
+bool Database::hasLiveView() const
+{
+    return m_liveView.isOpen();
+}
+
+// writer of the queued ingest, the producers wake it up when it waits
+void Database::ingestThreadFunc()
+{
+    while (!m_ingestStop)
+    {
+        uint32_t written = drainIngest();
+        if (written == ingestBatchSize)
+            continue;
+        // after a commit the samples of commitIntervalMs are gathered for the next one
+        std::chrono::milliseconds timeout(10);
+        if (written > 0)
+            timeout = std::chrono::milliseconds(m_options.commitIntervalMs);
+        std::unique_lock<std::mutex> lock(m_ingestMutex);
+        m_ingestIdle = true;
+        if (written > 0)
+            m_ingestCond.wait_for(lock, timeout, [this]() { return m_ingestStop || m_ingestFlushes > 0; });
+        else if (!m_ingestStop && m_ingestQueue->empty())
+            m_ingestCond.wait_for(lock, timeout);
+        m_ingestIdle = false;
+    }
+    // what was queued before the stop
+    while (drainIngest() > 0)
+        ;
+}
+
+// group commit: the queued samples of all the streams are written in one transaction,
+// ingestBatchSize at most
+uint32_t Database::drainIngest()
+{
+    if (m_ingestQueue->empty())
+        return 0;
+    m_ingestBusy = true;
+    IngestRecord record;
+    uint32_t total = 0;
+    beginWrite(LOCK_SITE_INGEST);
+    Timer timer(true);
+    execStatement(STMT_BEGIN);
+    while (total < ingestBatchSize && m_ingestQueue->tryPop(&record))
+    {
+        if (record.stream == 0 && m_options.storage == STORAGE_CHUNKED)
+            addChunked(record.time, &record.sample, 1);
+        else
+        {
+            addToInput(record.stream, record.time, record.sample);
+            addToOutput(record.stream, record.time, record.sample);
+        }
+        m_liveView.publish(record.stream, record.time, &record.sample, 1);
+        if (m_streamAdded[record.stream]++ == 0)
+            m_touchedStreams.push_back(record.stream);
+        total++;
+    }
+    execStatement(STMT_COMMIT);
+
+    bool retention = false;
+    for (size_t i = 0; i < m_touchedStreams.size(); i++)
+    {
+        uint32_t stream = m_touchedStreams[i];
+        // the chunks skip the samples older than the last one
+        if (m_startTime[stream] == 0 || (stream == 0 && m_options.storage == STORAGE_CHUNKED))
+            updateCounters(stream);
+        else
+            m_totalSamples[stream] += m_streamAdded[stream];
+        retention = retention || (m_totalSamples[stream] > m_limit);
+        m_streamAdded[stream] = 0;
+    }
+    m_touchedStreams.clear();
+    recordWrite(timer.stop());
+    endWrite();
+    if (retention)
+        scheduleRetention();
+    m_ingestWritten += total;
+    m_ingestBusy = false;
+    return total;
+}
+
+void Database::stopIngest()
+{
+    if (!m_ingestThread.joinable())
+        return;
+    m_ingestMutex.lock();
+    m_ingestStop = true;
+    m_ingestMutex.unlock();
+    m_ingestCond.notify_all();
+    m_ingestThread.join();
+}
+
+// compactor: checks for the cold rows once a second
+void Database::compactTaskFunc(PoolTask& task)
+{
+    // one chunk per lock, the ingest goes on between them
+    while (!task.isCancelled() && compactOldestChunk())
+        ;
+    m_tasks.submit(m_compactTask, 1000);
+}
+
+static void appendRow(ChannelBlock& block, sqlite3_stmt* pStmt)
+{
+    if (block.input)
+    {
+        InputData in;
+        in.delayFactor = sqlite3_column_double(pStmt, 0);
+        in.mediaLossRate = sqlite3_column_int(pStmt, 1);
+        in.rate = sqlite3_column_int(pStmt, 2);
+        in.samples = std::min<uint8_t>(sqlite3_column_int(pStmt, 4), maxSamples);
+        readPcr(pStmt, 3, in.pcrArray, in.samples);
+        block.append(sqlite3_column_int64(pStmt, 5), in);
+    }
+    else
+    {
+        OutputData out;
+        out.delayFactor = sqlite3_column_double(pStmt, 0);
+        out.rate = sqlite3_column_int(pStmt, 1);
+        out.samples = std::min<uint8_t>(sqlite3_column_int(pStmt, 3), maxSamples);
+        readPcr(pStmt, 2, out.pcrArray, out.samples);
+        block.append(sqlite3_column_int64(pStmt, 4), out);
+    }
+}
+
+static void appendSample(ChannelBlock& block, const ChannelBlock& from, uint32_t index, uint32_t& pcrOffset)
+{
+    if (block.input)
+    {
+        InputData in;
+        from.get(index, in, pcrOffset);
+        block.append(from.time[index], in);
+    }
+    else
+    {
+        OutputData out;
+        from.get(index, out, pcrOffset);
+        block.append(from.time[index], out);
+    }
+}
+
+// move the rows of the oldest chunk that is entirely compactAfterSeconds behind
+// the newest sample into the chunk tables; false when there is nothing to do
+bool Database::compactOldestChunk()
+{
+    beginWrite(LOCK_SITE_COMPACTION);
+    if (!m_pDb)
+    {
+        endWrite();
+        return false;
+    }
+
+    time_t firstTime = 0;
+    time_t lastTime = 0;
+    if (isPartitioned())
+    {
+        // from the counts of the partitions, the newest row of any stream
+        for (size_t i = 0; i < m_partitions.size() && firstTime == 0; i++)
+        {
+            uint32_t count;
+            countPartitionRows(m_partitions[i], 0, count, firstTime);
+        }
+        lastTime = m_newestTime;
+        if (firstTime == 0)
+        {
+            endWrite();
+            return false;
+        }
+    }
+    else
+    {
+        SQLiteRequest req(m_pDb, "SELECT MIN(time), MAX(time) FROM " + getRowSource(m_refSource, 0, endOfTime)
+                          + " WHERE stream = 0");
+        if (sqlite3_step(req.pStmt) != SQLITE_ROW || sqlite3_column_type(req.pStmt, 0) == SQLITE_NULL)
+        {
+            endWrite();
+            return false;
+        }
+        firstTime = sqlite3_column_int64(req.pStmt, 0);
+        lastTime = sqlite3_column_int64(req.pStmt, 1);
+    }
+    time_t chunkTime = firstTime - firstTime % m_options.chunkSeconds;
+    time_t chunkEnd = chunkTime + m_options.chunkSeconds;
+    if (chunkEnd + static_cast<time_t>(m_options.compactAfterSeconds) > lastTime)
+    {
+        endWrite();
+        return false;
+    }
+
+    // a transaction per group of partition files, each group is merged into the chunk
+    forEachPartitionGroup(m_pDb, chunkTime, chunkEnd - 1, [&](time_t groupStart, time_t groupEnd)
+    {
+        std::stringstream ss;
+        sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+        for (uint32_t i = 0; i < DS_COUNT; i++)
+        {
+            DataSource DS = static_cast<DataSource>(i);
+            if (!isStored(DS))
+                continue;
+
+            // rows imported after the chunk was written are merged into it
+            std::shared_ptr<const ChannelBlock> saved = readChunk(DS, chunkTime);
+            ChannelBlock block(i < DS_IN_TOTAL);
+            block.reserve(m_options.chunkSeconds);
+            uint32_t index = 0;
+            uint32_t pcrOffset = 0;
+
+            ss << "SELECT * FROM " << getRowSource(DS, groupStart, groupEnd) << " WHERE stream = 0 AND time >= "
+               << groupStart << " AND time <= " << groupEnd << " ORDER BY time";
+            SQLiteRequest req(m_pDb, ss.str());
+            ss.str("");
+            while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+            {
+                time_t rowTime = sqlite3_column_int64(req.pStmt, block.input ? 5 : 4);
+                while (saved && index < saved->size() && saved->time[index] < rowTime)
+                    appendSample(block, *saved, index++, pcrOffset);
+                if (saved && index < saved->size() && saved->time[index] == rowTime)
+                    continue;
+                if (block.empty() || block.time.back() < rowTime)
+                    appendRow(block, req.pStmt);
+            }
+            while (saved && index < saved->size())
+                appendSample(block, *saved, index++, pcrOffset);
+
+            writeChunk(DS, chunkTime, block);
 
-    time_t startTime = 0;
-    if (sqlite3_step(req.pStmt) == SQLITE_ROW)
+            std::vector<std::string> tables = getRowTables(DS, groupStart, groupEnd);
+            for (size_t j = 0; j < tables.size(); j++)
+            {
+                ss << "DELETE FROM " << tables[j] << " WHERE stream = 0 AND time >= " << groupStart << " AND time <= "
+                   << groupEnd;
+                sqlite3_exec(m_pDb, ss.str().c_str(), NULL, NULL, NULL);
+                ss.str("");
+            }
+        }
+        sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
+        m_blockCache.erase(chunkTime);
+        return true;
+    });
+    // the partitions of the chunk are counted again
+    for (size_t i = 0; i < m_partitions.size(); i++)
     {
-        startTime = sqlite3_column_int(req.pStmt, 0);
+        if (m_partitions[i] < chunkEnd && m_partitions[i] + static_cast<time_t>(m_options.partitionSeconds) > chunkTime)
+            m_partitionRows.erase(m_partitions[i]);
     }
-    m_DbMutex.unlock();
-    return startTime;
+    endWrite();
+    return true;
 }
 
-uint32_t Database::internalGetTotalSamples()
+static bool summaryMayMatch(const BlockSummary& summary, const ScanFilter& filter, bool input)
 {
-    SQLiteRequest req(m_pDb, "SELECT COUNT(*) FROM 'HP1'");
-    uint32_t totalSamples;
-    sqlite3_step(req.pStmt);
-    totalSamples = sqlite3_column_int(req.pStmt, 0);
-    return totalSamples;
+    return (filter.delayFactorAbove >= 0 && summary.maxDelayFactor > filter.delayFactorAbove) ||
+           (input && filter.mediaLossAbove >= 0 && summary.maxMediaLossRate > filter.mediaLossAbove) ||
+           (filter.rateBelow >= 0 && summary.minRate < filter.rateBelow) ||
+           (filter.rateAbove >= 0 && summary.maxRate > filter.rateAbove);
 }
 
-uint32_t Database::getTotalSamples()
+static bool sampleMatches(const ChannelBlock& block, uint32_t index, const ScanFilter& filter)
 {
-    m_DbMutex.lock();
-    uint32_t result = internalGetTotalSamples();
-    m_DbMutex.unlock();
-    return result;
+    return (filter.delayFactorAbove >= 0 && block.delayFactor[index] > filter.delayFactorAbove) ||
+           (filter.mediaLossAbove >= 0 && !block.mediaLossRate.empty() &&
+            block.mediaLossRate[index] > filter.mediaLossAbove) ||
+           (filter.rateBelow >= 0 && block.rate[index] < filter.rateBelow) ||
+           (filter.rateAbove >= 0 && block.rate[index] > filter.rateAbove);
 }
 
-bool Database::verifyIntegrity()
+// false when the callback stopped the scan
+static bool scanBlock(const ChannelBlock& block, DataSource source, time_t startTime, time_t endTime,
+                      const ScanFilter& filter, ScanCallback cb, void* userParam, ScanStats& stats)
 {
-    uint32_t iTotal = 0;
-    uint32_t iCurrent = 0;
-    bool iResult = true;
-    std::stringstream ss;
-    m_DbMutex.lock();
-    for (uint32_t i = 0; i < DS_COUNT; i++)
+    for (uint32_t i = block.findTime(startTime); i < block.size() && block.time[i] <= endTime; i++)
     {
-        DataSource DS = static_cast<DataSource>(i);
-        if (!isDataSourceSupported(DS))
+        stats.samplesRead++;
+        if (!sampleMatches(block, i, filter))
             continue;
-        ss << "SELECT COUNT(*) FROM " << getTableName(DS);
-        SQLiteRequest req(m_pDb, ss.str());
+        stats.matches++;
 
-        sqlite3_step(req.pStmt);
-        iCurrent = sqlite3_column_int(req.pStmt, 0);
-        if (iTotal == 0 && iCurrent != 0)
+        uint32_t pcrOffset = block.getPcrOffset(i);
+        InputData in;
+        OutputData out;
+        const void* data = NULL;
+        if (block.input)
         {
-            iTotal = iCurrent;
+            block.get(i, in, pcrOffset);
+            data = &in;
         }
-        else if (iTotal != iCurrent)
+        else
         {
-            iResult = false;
-            break;
+            block.get(i, out, pcrOffset);
+            data = &out;
         }
-        ss.str("");
+        if (cb && !cb(source, block.time[i], data, userParam))
+            return false;
     }
-    m_DbMutex.unlock();
-    return iResult;
+    return true;
 }
 
-void Database::add(time_t startTime, const LogSample* samples, uint32_t count)
+uint64_t Database::scan(DataSource source, time_t startTime, time_t endTime, const ScanFilter& filter,
+                        ScanCallback cb, void* userParam, ScanStats* stats)
 {
-    m_DbMutex.lock();
-    static uint32_t counter = 0;
-    for (uint32_t i = 0; i < count; i++)
-    {       
-        if (i % 100 == 0 && i != 0)
-            std::cout << i << " -  " << counter << " ITERATION" << '\n';
-        if (internalGetTotalSamples() >= m_limit)
+    ScanStats localStats;
+    ScanStats& st = stats ? *stats : localStats;
+    st = ScanStats();
+    if (!isStored(source))
+        return 0;
+    bool input = (source < DS_IN_TOTAL);
+
+    // saved chunks, oldest first; the lock is taken per chunk, the callback runs without it
+    std::vector<time_t> chunks;
+    std::stringstream ss;
+    sqlite3* db = beginRead(LOCK_SITE_SCAN);
+    if (!db)
+        return 0;
+    ss << "SELECT chunkTime, minDelayFactor, maxDelayFactor, minRate, maxRate, maxMediaLossRate FROM "
+       << getChunkTableName(source) << " WHERE endTime >= " << startTime << " AND startTime <= " << endTime
+       << " AND chunkTime != " << m_openChunkTime << " ORDER BY chunkTime";
+    {
+        SQLiteRequest req(db, ss.str());
+        while (sqlite3_step(req.pStmt) == SQLITE_ROW)
         {
-            deleteFirstSample();
+            st.blocks++;
+            // chunks written before the zone maps are always read
+            if (sqlite3_column_type(req.pStmt, 1) != SQLITE_NULL)
+            {
+                BlockSummary summary;
+                summary.minDelayFactor = static_cast<float>(sqlite3_column_double(req.pStmt, 1));
+                summary.maxDelayFactor = static_cast<float>(sqlite3_column_double(req.pStmt, 2));
+                summary.minRate = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 3));
+                summary.maxRate = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 4));
+                summary.maxMediaLossRate = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 5));
+                if (!summaryMayMatch(summary, filter, input))
+                {
+                    st.blocksSkipped++;
+                    continue;
+                }
+            }
+            chunks.push_back(sqlite3_column_int64(req.pStmt, 0));
         }
-        addToInput(startTime + i, samples[i]);
-        addToOutput(startTime + i, samples[i]);
     }
-    counter++;
-    m_DbMutex.unlock();
-}
-
+    endRead(db);
+    ss.str("");
 
-void Database::addT(time_t startTime, const LogSample* samples, uint32_t count)
-{
-    m_DbMutex.lock();
-    uint32_t entire = count / m_transPackSize; // -  
-    uint32_t balance = count % m_transPackSize; //      
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        db = beginRead(LOCK_SITE_SCAN);
+        if (!db)
+            return st.matches;
+        std::shared_ptr<const ChannelBlock> block = readChunk(source, chunks[i], db);
+        endRead(db);
+        if (block && !scanBlock(*block, source, startTime, endTime, filter, cb, userParam, st))
+            return st.matches;
+    }
 
-    uint32_t transPackSize;
-    uint32_t progress;
-    uint32_t j;
-    for (uint32_t i = 0; i <= entire; i++)
+    // the newest data: the open chunk, or the rows filtered by SQLite
+    ChannelBlock recent(input);
+    db = beginRead(LOCK_SITE_SCAN);
+    if (!db)
+        return st.matches;
+    if (m_options.storage == STORAGE_CHUNKED)
+        recent = m_openChunk[source];
+    else
     {
-        j = i * m_transPackSize;
-        if (i != entire)
-            transPackSize = m_transPackSize;
-        else
-            transPackSize = balance;
+        const char* columns[] = { "delayFactor >", "mediaLossRate >", "rate <", "rate >" };
+        double values[] = { filter.delayFactorAbove, static_cast<double>(filter.mediaLossAbove),
+                            static_cast<double>(filter.rateBelow), static_cast<double>(filter.rateAbove) };
+        forEachPartitionGroup(db, startTime, endTime, [&](time_t groupStart, time_t groupEnd)
+        {
+            uint32_t used = 0;
+            ss << "SELECT * FROM " << getRowSource(source, groupStart, groupEnd) << " WHERE stream = 0 AND time >= "
+               << startTime << " AND time <= " << endTime << " AND (0";
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                if (values[i] >= 0 && (input || i != 1))
+                {
+                    ss << " OR " << columns[i] << " ?" << ++used;
+                }
+            }
+            ss << ") ORDER BY time";
 
-        progress = (balance == 0) ? (j) : (i != entire) ? (j) : ((i - 1) * m_transPackSize + balance);
-        if (progress % 10000 == 0 && progress != 0)
-            std::cout << progress << '\n';
-        uint32_t total = internalGetTotalSamples();
-        if (total >= m_limit)
-            deleteFirstNSamples(total - m_limit + transPackSize);
-        addToInputT(startTime + j, samples + j, transPackSize);
-        addToOutputT(startTime + j, samples + j, transPackSize);
+            if (used)
+            {
+                SQLiteRequest req(db, ss.str());
+                used = 0;
+                for (uint32_t i = 0; i < 4; i++)
+                {
+                    if (values[i] >= 0 && (input || i != 1))
+                        sqlite3_bind_double(req.pStmt, ++used, values[i]);
+                }
+                while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+                    appendRow(recent, req.pStmt);
+            }
+            ss.str("");
+            return used > 0;
+        });
     }
-    m_DbMutex.unlock();
+    endRead(db);
+    scanBlock(recent, source, startTime, endTime, filter, cb, userParam, st);
+    return st.matches;
 }
 
+static void mergeSummary(AggregateResult& result, const BlockSummary& summary, uint64_t count)
+{
+    if (result.count == 0)
+        result.summary = summary;
+    else
+    {
+        BlockSummary& total = result.summary;
+        total.minDelayFactor = std::min(total.minDelayFactor, summary.minDelayFactor);
+        total.maxDelayFactor = std::max(total.maxDelayFactor, summary.maxDelayFactor);
+        total.minRate = std::min(total.minRate, summary.minRate);
+        total.maxRate = std::max(total.maxRate, summary.maxRate);
+        total.maxMediaLossRate = std::max(total.maxMediaLossRate, summary.maxMediaLossRate);
+        total.sumMediaLossRate += summary.sumMediaLossRate;
+        total.lossSeconds += summary.lossSeconds;
+    }
+    result.count += count;
+}
 
-
-
-uint32_t Database::get(LogSample* samples, uint32_t count, time_t startTime)
+static void aggregateBlock(const ChannelBlock& block, time_t startTime, time_t endTime, AggregateResult& result)
 {
-    uint32_t localCount = 0;
-    uint32_t iResult = 0;
-    while (count > 0)
+    uint32_t first = block.findTime(startTime);
+    uint32_t last = block.findTime(endTime + 1);
+    if (first >= last)
+        return;
+    BlockSummary summary = {};
+    summary.minDelayFactor = summary.maxDelayFactor = block.delayFactor[first];
+    summary.minRate = summary.maxRate = block.rate[first];
+    for (uint32_t i = first; i < last; i++)
     {
-        localCount = internalGet(samples + iResult, count, startTime);
-        if (localCount == 0)
-            break;
-        count -= localCount;
-        iResult += localCount;
+        summary.minDelayFactor = std::min(summary.minDelayFactor, block.delayFactor[i]);
+        summary.maxDelayFactor = std::max(summary.maxDelayFactor, block.delayFactor[i]);
+        summary.minRate = std::min(summary.minRate, block.rate[i]);
+        summary.maxRate = std::max(summary.maxRate, block.rate[i]);
+        if (!block.mediaLossRate.empty())
+        {
+            summary.maxMediaLossRate = std::max(summary.maxMediaLossRate, block.mediaLossRate[i]);
+            summary.sumMediaLossRate += block.mediaLossRate[i];
+            summary.lossSeconds += (block.mediaLossRate[i] != 0);
+        }
     }
-    return iResult;
+    mergeSummary(result, summary, last - first);
 }
 
-void Database::clear()
+bool Database::aggregate(DataSource source, time_t startTime, time_t endTime, AggregateResult& result)
 {
+    result = AggregateResult();
+    if (!isStored(source))
+        return false;
+    bool input = (source < DS_IN_TOTAL);
+
+    // saved chunks: the zone map of a chunk in the range is its summary
+    std::vector<time_t> chunks;
     std::stringstream ss;
-    m_DbMutex.lock();  
-    sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
-    for (uint32_t i = 0; i < DS_COUNT; i++)
+    sqlite3* db = beginRead(LOCK_SITE_AGGREGATE);
+    if (!db)
+        return false;
+    ss << "SELECT chunkTime, startTime, endTime, count, minDelayFactor, maxDelayFactor, minRate, maxRate, "
+       << "maxMediaLossRate, sumMediaLossRate, lossSeconds FROM " << getChunkTableName(source)
+       << " WHERE endTime >= " << startTime << " AND startTime <= " << endTime
+       << " AND chunkTime != " << m_openChunkTime << " ORDER BY chunkTime";
     {
-        DataSource DS = static_cast<DataSource>(i);
-        ss << "DROP TABLE IF EXISTS " << getTableName(DS) << ";";
+        SQLiteRequest req(db, ss.str());
+        while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+        {
+            result.blocks++;
+            bool inside = sqlite3_column_int64(req.pStmt, 1) >= startTime && sqlite3_column_int64(req.pStmt, 2) <= endTime;
+            // chunks written before the zone maps are read
+            if (!inside || sqlite3_column_type(req.pStmt, 4) == SQLITE_NULL)
+            {
+                chunks.push_back(sqlite3_column_int64(req.pStmt, 0));
+                continue;
+            }
+            BlockSummary summary;
+            summary.minDelayFactor = static_cast<float>(sqlite3_column_double(req.pStmt, 4));
+            summary.maxDelayFactor = static_cast<float>(sqlite3_column_double(req.pStmt, 5));
+            summary.minRate = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 6));
+            summary.maxRate = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 7));
+            summary.maxMediaLossRate = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 8));
+            summary.sumMediaLossRate = static_cast<uint64_t>(sqlite3_column_int64(req.pStmt, 9));
+            summary.lossSeconds = static_cast<uint32_t>(sqlite3_column_int64(req.pStmt, 10));
+            mergeSummary(result, summary, sqlite3_column_int(req.pStmt, 3));
+            result.blocksSummarized++;
+        }
+    }
+    endRead(db);
+    ss.str("");
 
-        SQLiteRequest req(m_pDb, ss.str());
-        sqlite3_step(req.pStmt); // 
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        db = beginRead(LOCK_SITE_AGGREGATE);
+        if (!db)
+            return false;
+        std::shared_ptr<const ChannelBlock> block = readChunk(source, chunks[i], db);
+        endRead(db);
+        if (block)
+            aggregateBlock(*block, startTime, endTime, result);
+    }
 
-        ss.str("");
+    // the newest data: the open chunk or the rows
+    ChannelBlock recent(input);
+    db = beginRead(LOCK_SITE_AGGREGATE);
+    if (!db)
+        return false;
+    if (m_options.storage == STORAGE_CHUNKED)
+        recent = m_openChunk[source];
+    else
+    {
+        forEachPartitionGroup(db, startTime, endTime, [&](time_t groupStart, time_t groupEnd)
+        {
+            ss << "SELECT * FROM " << getRowSource(source, groupStart, groupEnd) << " WHERE stream = 0 AND time >= "
+               << startTime << " AND time <= " << endTime << " ORDER BY time";
+            SQLiteRequest req(db, ss.str());
+            ss.str("");
+            while (sqlite3_step(req.pStmt) == SQLITE_ROW)
+                appendRow(recent, req.pStmt);
+            return true;
+        });
     }
-    sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
-    createTables();
-    m_DbMutex.unlock();
+    endRead(db);
+    aggregateBlock(recent, startTime, endTime, result);
+    return true;
 }
 
-int delFucnt(std::string buffName)
+std::future<std::vector<LogSample>> Database::getAsync(time_t startTime, uint32_t count, uint32_t stream)
 {
-    int result = remove(buffName.c_str());
-    return result;
+    // the task function is copied, the promise is not
+    std::shared_ptr<std::promise<std::vector<LogSample>>> promise = std::make_shared<std::promise<std::vector<LogSample>>>();
+    std::shared_ptr<PoolTask> task = m_queries.submit("get", TASK_NORMAL,
+                                                      [this, promise, startTime, count, stream](PoolTask&)
+    {
+        std::vector<LogSample> samples(count);
+        samples.resize(count ? get(stream, &samples[0], count, startTime) : 0);
+        promise->set_value(std::move(samples));
+    });
+    // the pool is stopped (the database is being destroyed): no samples rather than a broken promise
+    if (task->isCancelled())
+        promise->set_value(std::vector<LogSample>());
+    return promise->get_future();
 }
 
-void Database::clearFake(std::ofstream& fs)
+void Database::getAsync(time_t startTime, uint32_t count, uint32_t stream, GetCallback cb, void* userParam)
 {
-    Timer timer;
-    
-    timer.start();
-    close();
-    double timeStampClose = timer.stop();
-    m_DbMutex.lock();
+    std::shared_ptr<PoolTask> task = m_queries.submit("get", TASK_NORMAL,
+                                                      [this, startTime, count, stream, cb, userParam](PoolTask&)
+    {
+        std::vector<LogSample> samples(count);
+        uint32_t result = count ? get(stream, &samples[0], count, startTime) : 0;
+        cb(result ? &samples[0] : NULL, result, startTime, userParam);
+    });
+    // the pool is stopped (the database is being destroyed): the read fails now
+    if (task->isCancelled())
+        cb(NULL, 0, startTime, userParam);
+}
 
-    // rename    
-    std::string buffName = m_dbFileName;
-    buffName.erase(buffName.size() - 3, 3);
-    buffName += "Del.db";
-    rename(m_dbFileName.c_str(), buffName.c_str());
-    std::thread deleteThread(delFucnt, buffName);
-    deleteThread.detach();
+std::future<AggregateResult> Database::aggregateAsync(DataSource source, time_t startTime, time_t endTime)
+{
+    std::shared_ptr<std::promise<AggregateResult>> promise = std::make_shared<std::promise<AggregateResult>>();
+    std::shared_ptr<PoolTask> task = m_queries.submit("aggregate", TASK_NORMAL,
+                                                      [this, promise, source, startTime, endTime](PoolTask&)
+    {
+        AggregateResult result;
+        aggregate(source, startTime, endTime, result);
+        promise->set_value(result);
+    });
+    if (task->isCancelled())
+        promise->set_value(AggregateResult());
+    return promise->get_future();
+}
 
-   
+void Database::aggregateAsync(DataSource source, time_t startTime, time_t endTime, AggregateCallback cb,
+                              void* userParam)
+{
+    std::shared_ptr<PoolTask> task = m_queries.submit("aggregate", TASK_NORMAL,
+                                                      [this, source, startTime, endTime, cb, userParam](PoolTask&)
+    {
+        AggregateResult result;
+        aggregate(source, startTime, endTime, result);
+        cb(result, userParam);
+    });
+    if (task->isCancelled())
+        cb(AggregateResult(), userParam);
+}
 
-    timer.start();
-#ifdef OS_WINDOWS
-    std::string bashCommand;
-    bashCommand = "cp " + m_dbEmptyFileName + " " + m_dbFileName;
-    system(bashCommand.c_str());
-#elif defined OS_LINUX
-    system("copy c:\\repos-projects\\sqlitepich\\database\\database\\mydatabaselinuxempty.db \
-				   c:\\repos-projects\\sqlitepich\\database\\database\\mydatabaselinuxempty.db ");
-#endif
-    double timeStampCP = timer.stop();
+std::future<bool> Database::verifyIntegrityAsync()
+{
+    std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+    std::shared_ptr<PoolTask> task = m_queries.submit("verify", TASK_NORMAL,
+                                                      [this, promise](PoolTask&) { promise->set_value(verifyIntegrity()); });
+    if (task->isCancelled())
+        promise->set_value(false);
+    return promise->get_future();
+}
 
-    //  
-    m_DbMutex.unlock();
-    timer.start();
-    this->open(m_dbFileName, false);
-    double timeStampOpen = timer.stop();
-    fs << timeStampClose << ", " << timeStampCP << ", " << timeStampOpen << ", ";
+// under the writer lock: a decaying average of the time the writes hold the lock, so one slow
+// write counts less than a slow ingest
+void Database::recordWrite(double duration)
+{
+    double latency = m_writerLatency;
+    m_writerLatency = latency + (duration - latency) * writerLatencyWeight;
+    m_lastWrite = LockProfiler::now();
 }
 
-bool Database::dump(const std::string& fileName)
+// the average halves every writerLatencyHalfLife seconds without writes
+double Database::getWriterLatency() const
 {
-    std::ofstream fs;
-    std::string logName = "dumpLog.csv";
-    fs.open(logName);
-    fs << "get\n"; // << "fwrite, " << "summ, " << "result, \n";
-    double result = 0;
-    Timer timer;
-    FILE* f = fopen(fileName.c_str(), "wt");
+    double idle = (LockProfiler::now() - m_lastWrite) * 1e-9;
+    return m_writerLatency * std::pow(0.5, idle / writerLatencyHalfLife);
+}
 
-    char buffer[512];
-    uint32_t numBytes;
+// returns early when the job is cancelled
+void Database::waitForIngest(const DumpOptions& options, const DumpJob* job)
+{
+    // writers queued on the lock: wait until they are served
+    uint32_t backoffMs = options.backoffMs;
+    while (options.maxPendingWriters > 0 && m_pendingWriters > options.maxPendingWriters)
+    {
+        if (job && job->isCancelled())
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+        backoffMs = std::min(backoffMs * 2, options.maxBackoffMs);
+    }
+    // the writes have slowed down (by us or by the disk): give the writer some room
+    if (options.maxWriterLatency > 0 && getWriterLatency() > options.maxWriterLatency)
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.backoffMs));
+}
 
-    // create and write header
-    numBytes = createLogHeaderCSV(buffer, sizeof(buffer));
-    if (numBytes == 0)
+bool Database::backup(const std::string& fileName, int pagesPerStep, uint32_t pauseMs,
+                      BackupCallback cb, void* userParam)
+{
+    // the rows are in the partition files, the main one has their list only
+    if (usesPartitionFiles())
         return false;
 
-    fwrite(buffer, numBytes, 1, f);
+    sqlite3* pDest = NULL;
+    int errCode = sqlite3_open_v2(fileName.c_str(), &pDest, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if (errCode != SQLITE_OK)
+    {
+        sqlite3_close(pDest);
+        return false;
+    }
 
-    LogSample* samples = new LogSample[m_atomicDumpSize];
-    int cnt = 0;
-    bool flag = true;
-    time_t nextTimeStamp = getStartTime();// +100 * m_atomicDumpSize;
-    int j = 0;
+    beginWrite(LOCK_SITE_BACKUP);
+    sqlite3_backup* pBackup = m_pDb ? sqlite3_backup_init(pDest, "main", m_pDb, "main") : NULL;
+    if (pBackup)
+        m_backups++;
+    endWrite();
+    if (!pBackup)
+    {
+        sqlite3_close(pDest);
+        return false;
+    }
+
+    // every step takes a consistent snapshot of the next pages, writes made by
+    // our own connection between the steps are propagated to the copy by SQLite
     do
     {
-        double summ = 0;
-        if (j != 0)
-            std::cout << j * m_atomicDumpSize << "\n";
-        timer.start();
-        cnt = internalGet(samples, m_atomicDumpSize, nextTimeStamp);
-        double getTime = timer.stop();
-        fs << getTime << "\n";
-        for (uint32_t i = 0; i < cnt; i++)
-        {
-            numBytes = createLogEntryCSV(buffer, sizeof(buffer), (nextTimeStamp - cnt) + i, samples[i]);
-            if (numBytes == 0)
-                return false;
-            fwrite(buffer, numBytes, 1, f);
-        }  
-        j++;
-    } while (cnt > 0);
-    delete[] samples;
-    fs.close();
-    fclose(f);
-    return true;
+        beginWrite(LOCK_SITE_BACKUP);
+        errCode = sqlite3_backup_step(pBackup, pagesPerStep);
+        uint32_t remaining = sqlite3_backup_remaining(pBackup);
+        uint32_t total = sqlite3_backup_pagecount(pBackup);
+        endWrite();
+
+        if (cb)
+            cb(remaining, total, userParam);
+
+        if (errCode != SQLITE_DONE && pauseMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+    } while (errCode == SQLITE_OK || errCode == SQLITE_BUSY || errCode == SQLITE_LOCKED);
+
+    beginWrite(LOCK_SITE_BACKUP);
+    sqlite3_backup_finish(pBackup);
+    m_backups--;
+    endWrite();
+    sqlite3_close(pDest);
+    return (errCode == SQLITE_DONE);
 }
 
-
 bool Database::deleteFirstSample()
 {
     std::stringstream ss;
     for (uint32_t i = 0; i < DS_COUNT; i++)
     {
         DataSource DS = static_cast<DataSource>(i);
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
         ss << "DELETE FROM " << getTableName(DS) << " WHERE time IN (SELECT time FROM " << getTableName(DS)
             << " WHERE TIME > 0 LIMIT 1)";
@@ -431,28 +3253,31 @@ bool Database::deleteFirstSample()
     return true;
 }
 
-bool Database::deleteFirstNSamples(uint32_t n)
+bool Database::deleteFirstNSamples(uint32_t stream, uint32_t n)
 {
-    std::stringstream ss;
+    // compacted rows are the oldest, they go first
+    if (stream == 0 && usesChunks())
+        n = deleteFirstChunks(n);
+    if (n == 0)
+        return true;
 
-    sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    execStatement(STMT_BEGIN);
     for (uint32_t i = 0; i < DS_COUNT; i++)
     {
         DataSource DS = static_cast<DataSource>(i);
 
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
-        ss << "DELETE FROM " << getTableName(DS) << " WHERE time IN (SELECT time FROM " << getTableName(DS)
-            << " WHERE TIME > 0 LIMIT " << n << ")\n";
-        SQLiteRequest req(m_pDb, ss.str());
+        CachedRequest req(getStatement(STMT_DELETE_FIRST + DS));
+        sqlite3_bind_int(req.pStmt, 1, n);
+        sqlite3_bind_int(req.pStmt, 2, stream);
         int errCode = sqlite3_step(req.pStmt); // 
-        ss.str("");
     }
-    sqlite3_exec(m_pDb, "COMMIT TRANSACTION", NULL, NULL, NULL);
+    execStatement(STMT_COMMIT);
     return true;
 }
 
-uint32_t Database::internalGet(LogSample* samples, uint32_t count, time_t& startTime)
+uint32_t Database::internalGet(uint32_t stream, LogSample* samples, uint32_t count, time_t& startTime)
 {
     Timer timer;
    /* std::string filename = "iGetLog.csv";
@@ -461,73 +3286,94 @@ uint32_t Database::internalGet(LogSample* samples, uint32_t count, time_t& start
     if (count > m_atomicDumpSize)
         count = m_atomicDumpSize;
 
-    std::stringstream ss;
-    uint32_t verifyArr[DS_COUNT] = { 0 };
-
-    m_DbMutex.lock();
-    for (uint32_t i = 0; i < DS_COUNT; i++)
+    // chunked storage, or the compacted rows (stream 0)
+    time_t chunkTime;
+    sqlite3* db = beginRead(LOCK_SITE_GET);
+    if (!db)
+        return 0;
+    if (stream == 0 && usesChunks() && (m_options.storage == STORAGE_CHUNKED || findChunk(startTime, chunkTime, db)))
     {
-        DataSource DS = static_cast<DataSource>(i);
-        if (!isDataSourceSupported(DS))
-            continue;
+        uint32_t iResult = internalGetChunked(samples, count, startTime, db);
+        endRead(db);
+        return iResult;
+    }
 
-        ss << "SELECT * FROM " << getTableName(DS) << " WHERE time >= " << startTime << " LIMIT " << count;
+    std::stringstream ss;
+    uint32_t iResult = 0;
 
-        SQLiteRequest req(m_pDb, ss.str());
-        if (i < DS_IN_TOTAL)
+    // the partition files are read a group at a time from the first one with rows of the stream,
+    // the run goes on in the next group when it reaches the end of this one
+    forEachPartitionGroup(db, startTime, endOfTime, [&](time_t groupStart, time_t groupEnd)
+    {
+        time_t fromTime = startTime + iResult;
+        if (usesPartitionFiles())
         {
-            if (i == DS_IN_HP1)
-            {
-                DBData data = getInputData(DS, samples, count, req.pStmt);
-                startTime = data.startTime;
-                verifyArr[i] = data.counter;
-            }
-            else
-                verifyArr[i] = getInputData(DS, samples, count, req.pStmt).counter;
+            ss << "SELECT 1 FROM " << getRowSource(m_refSource, groupStart, groupEnd) << " WHERE stream = " << stream
+               << " AND time >= " << fromTime << " LIMIT 1";
+            SQLiteRequest req(db, ss.str());
+            ss.str("");
+            if (sqlite3_step(req.pStmt) != SQLITE_ROW)
+                return iResult == 0;
         }
-        else
+        uint32_t verifyArr[DS_COUNT] = { 0 };
+        time_t firstTime = 0;
+        for (uint32_t i = 0; i < DS_COUNT; i++)
         {
-            verifyArr[i] = getOutputData(DS, samples, count, req.pStmt).counter;
+            DataSource DS = static_cast<DataSource>(i);
+            if (!isStored(DS))
+                continue;
+
+            ss << "SELECT * FROM " << getRowSource(DS, groupStart, groupEnd) << " WHERE stream = " << stream
+               << " AND time >= " << fromTime << " LIMIT " << count - iResult;
+
+            SQLiteRequest req(db, ss.str());
+            // a shard of the outputs only has an output reference source
+            DBData data = (i < DS_IN_TOTAL) ? getInputData(DS, samples + iResult, count - iResult, req.pStmt)
+                                            : getOutputData(DS, samples + iResult, count - iResult, req.pStmt);
+            verifyArr[i] = data.counter;
+            if (i == m_refSource)
+                firstTime = data.startTime;
+            ss.str("");
         }
-        ss.str("");
-    }
-    m_DbMutex.unlock();
-
-    uint32_t iResult = verifyArr[0];
-
-    for (int i = 1; i < DS_COUNT; i++)
-    {
-        DataSource DS = static_cast<DataSource>(i);
-        if (!isDataSourceSupported(DS))
-            continue;
 
-        if (iResult != verifyArr[i])
-            return 0;
-    }
+        uint32_t groupCount = verifyArr[m_refSource];
+        for (uint32_t i = 0; i < DS_COUNT; i++)
+        {
+            if (isStored(static_cast<DataSource>(i)) && verifyArr[i] != groupCount)
+                return false;
+        }
+        if (groupCount == 0 || (iResult && firstTime != fromTime))
+            return false;
+        if (iResult == 0)
+            startTime = firstTime;
+        iResult += groupCount;
+        return iResult < count && startTime + iResult > groupEnd;
+    });
+    endRead(db);
 
     startTime += iResult;
     //fs.close();
     return iResult;
 }
 
-void Database::addToInput(time_t currTime, const LogSample& sample)
+void Database::addToInput(uint32_t stream, time_t currTime, const LogSample& sample)
 {
     Timer timer;
     const InputData* arrayIn[DS_IN_TOTAL] = { &sample.hp1,  &sample.lp1,
                                                                  &sample.hp2,  &sample.lp2 };
-    std::stringstream ss;
+    uint16_t halves[maxSamples];
+    uint16_t* pHalves = (m_options.pcrPrecision == PCR_FLOAT16) ? halves : NULL;
     for (uint32_t i = 0; i < DS_IN_TOTAL; i++)
     {
         DataSource DS = static_cast<DataSource>(i + DS_IN_BASE);
 
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
 
-        ss << "INSERT INTO " << getTableName(DS) << "(delayFactor, mediaLossRate, rate, pcrArray,\
-										samples, time)  VALUES(?,?,?,?,?,?);";
         const InputData* in = arrayIn[i];
+        usePartition(currTime);
         timer.start(); // 1
-        SQLiteRequest req(m_pDb, ss.str());
+        CachedRequest req(getStatement(STMT_INSERT + DS));
         double timeStampReq = timer.stop();
         timer.start(); // 2
         sqlite3_bind_double(req.pStmt, 1, in->delayFactor);
@@ -542,7 +3388,7 @@ void Database::addToInput(time_t currTime, const LogSample& sample)
         double timeStampRate = timer.stop();
         //std::cout << in->rate << "\n";
         timer.start(); // 5
-        sqlite3_bind_blob(req.pStmt, 4, in->pcrArray, sizeof(float) * in->samples, NULL);
+        bindPcr(req.pStmt, 4, in->pcrArray, in->samples, pHalves);
         double timeStampArr = timer.stop();
         //std::cout << sizeof(float) * in->samples << "\n";
         timer.start(); // 6
@@ -553,32 +3399,32 @@ void Database::addToInput(time_t currTime, const LogSample& sample)
         sqlite3_bind_int(req.pStmt, 6, currTime);
         double timeStampCurrTime = timer.stop();
         //std::cout << currTime << "\n";
+        sqlite3_bind_int(req.pStmt, 7, stream);
         timer.start(); // 8
         sqlite3_step(req.pStmt);
         double timeStampStep = timer.stop();        
-        ss.str("");
     }
 }
 
-void Database::addToOutput(time_t currTime, const LogSample& sample)
+void Database::addToOutput(uint32_t stream, time_t currTime, const LogSample& sample)
 {
     Timer timer;
     const OutputData* arrayOut[DS_OUT_TOTAL] = { &sample.hpOut, &sample.lpOut };
 
-    std::stringstream ss;
+    uint16_t halves[maxSamples];
+    uint16_t* pHalves = (m_options.pcrPrecision == PCR_FLOAT16) ? halves : NULL;
     for (uint32_t i = 0; i < DS_OUT_TOTAL; i++)
     {
         DataSource DS = static_cast<DataSource>(i + DS_OUT_BASE);
 
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
 
         const OutputData* out = arrayOut[i];
-        ss << "INSERT INTO " << getTableName(DS) << "(delayFactor, rate, pcrArray,\
-										samples, time)  VALUES(?,?,?,?,?);";
+        usePartition(currTime);
 
         timer.start(); // 1
-        SQLiteRequest req(m_pDb, ss.str());
+        CachedRequest req(getStatement(STMT_INSERT + DS));
         double timeStampReq = timer.stop();
         timer.start(); // 2
         sqlite3_bind_double(req.pStmt, 1, out->delayFactor);
@@ -587,7 +3433,7 @@ void Database::addToOutput(time_t currTime, const LogSample& sample)
         sqlite3_bind_int(req.pStmt, 2, out->rate);
         double timeStampRate = timer.stop();
         timer.start(); // 4
-        sqlite3_bind_blob(req.pStmt, 3, out->pcrArray, sizeof(float) * out->samples, NULL);
+        bindPcr(req.pStmt, 3, out->pcrArray, out->samples, pHalves);
         double timeStampArr = timer.stop();
         timer.start(); // 5
         sqlite3_bind_int(req.pStmt, 4, out->samples);
@@ -595,88 +3441,86 @@ void Database::addToOutput(time_t currTime, const LogSample& sample)
         timer.start(); // 6
         sqlite3_bind_int(req.pStmt, 5, currTime);
         double timeStampCurrTime = timer.stop();
+        sqlite3_bind_int(req.pStmt, 6, stream);
         timer.start(); // 7
         sqlite3_step(req.pStmt);
         double timeStampStep = timer.stop(); 
-        ss.str("");
     }
 }
 
-void Database::addToInputT(time_t currTime, const LogSample* samples, uint32_t count)
+void Database::addToInputT(uint32_t stream, time_t currTime, const LogSample* samples, uint32_t count)
 {
     if (count == 0)
         return;
-    std::stringstream ss;
     Timer timer;
+    uint16_t halves[maxSamples];
+    uint16_t* pHalves = (m_options.pcrPrecision == PCR_FLOAT16) ? halves : NULL;
     for (uint32_t i = 0; i < DS_IN_TOTAL; i++)
     {
         DataSource DS = static_cast<DataSource>(i + DS_IN_BASE);
 
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
         //timer.start();
-        sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+        execStatement(STMT_BEGIN);
         //double timeStampBegin = timer.stop();
         //timer.start();
         for (uint32_t j = 0; j < count; j++)
         {
-            ss << "INSERT INTO " << getTableName(DS) << "(delayFactor, mediaLossRate, rate, pcrArray,\
-										samples, time)  VALUES(?,?,?,?,?,?);\n";
-            LogSample sample = samples[j];
-            const InputData* in = static_cast<InputData*>(getSample(sample, DS));
-            SQLiteRequest req(m_pDb, ss.str());
+            const InputData* in = static_cast<const InputData*>(getSample(samples[j], DS));
+            usePartition(currTime + j);
+            CachedRequest req(getStatement(STMT_INSERT + DS));
             sqlite3_bind_double(req.pStmt, 1, in->delayFactor);
             sqlite3_bind_int(req.pStmt, 2, in->mediaLossRate);
             sqlite3_bind_int(req.pStmt, 3, in->rate);
-            sqlite3_bind_blob(req.pStmt, 4, in->pcrArray, sizeof(float) * in->samples, NULL);
+            bindPcr(req.pStmt, 4, in->pcrArray, in->samples, pHalves);
             sqlite3_bind_int(req.pStmt, 5, in->samples);
             sqlite3_bind_int(req.pStmt, 6, currTime + j);
+            sqlite3_bind_int(req.pStmt, 7, stream);
             int errCode = sqlite3_step(req.pStmt);
-            ss.str("");
         }
         //double timeStampCycle = timer.stop();
         //timer.start();
-        sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
+        execStatement(STMT_COMMIT);
         //double timeStampEnd = timer.stop();
         //fs << timeStampBegin << ", " << timeStampCycle << ", " << timeStampEnd << ", "; 
     }
 }
 
-void Database::addToOutputT(time_t currTime, const LogSample* samples, uint32_t count)
+void Database::addToOutputT(uint32_t stream, time_t currTime, const LogSample* samples, uint32_t count)
 {
     if (count == 0)
         return;
-    std::stringstream ss;
     Timer timer;
+    uint16_t halves[maxSamples];
+    uint16_t* pHalves = (m_options.pcrPrecision == PCR_FLOAT16) ? halves : NULL;
     for (uint32_t i = 0; i < DS_OUT_TOTAL; i++)
     {
         DataSource DS = static_cast<DataSource>(i + DS_OUT_BASE);
 
-        if (!isDataSourceSupported(DS))
+        if (!isStored(DS))
             continue;
 
         //timer.start();
-        sqlite3_exec(m_pDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+        execStatement(STMT_BEGIN);
         //double timeStampBegin = timer.stop();
         //timer.start();
         for (uint32_t j = 0; j < count; j++)
         {
-            ss << "INSERT INTO " << getTableName(DS) << "(delayFactor, rate, pcrArray,\
-										samples, time)  VALUES(?,?,?,?,?);";
-            LogSample sample = samples[j];
-            const OutputData* out = static_cast<OutputData*>(getSample(sample, DS));
-            SQLiteRequest req(m_pDb, ss.str());
+            const OutputData* out = static_cast<const OutputData*>(getSample(samples[j], DS));
+            usePartition(currTime + j);
+            CachedRequest req(getStatement(STMT_INSERT + DS));
             sqlite3_bind_double(req.pStmt, 1, out->delayFactor);
             sqlite3_bind_int(req.pStmt, 2, out->rate);
-            sqlite3_bind_blob(req.pStmt, 3, out->pcrArray, sizeof(float) * out->samples, NULL);
+            bindPcr(req.pStmt, 3, out->pcrArray, out->samples, pHalves);
             sqlite3_bind_int(req.pStmt, 4, out->samples);
             sqlite3_bind_int(req.pStmt, 5, currTime + j);
+            sqlite3_bind_int(req.pStmt, 6, stream);
             int errCode = sqlite3_step(req.pStmt);
-            ss.str("");
         }
         //double timeStampCycle = timer.stop();
         //timer.start();
-        sqlite3_exec(m_pDb, "END TRANSACTION", NULL, NULL, NULL);
+        execStatement(STMT_COMMIT);
         //double timeStampEnd = timer.stop();
         //fs << timeStampBegin << ", " << timeStampCycle << ", " << timeStampEnd << ", \n";
     }
@@ -707,6 +3551,11 @@ void* Database::getSample(LogSample& sample, DataSource source)
     }
 }
 
+const void* Database::getSample(const LogSample& sample, DataSource source) const
+{
+    return const_cast<Database*>(this)->getSample(const_cast<LogSample&>(sample), source);
+}
+
 DBData Database::getInputData(DataSource source, LogSample* samples, uint32_t count, sqlite3_stmt* pStmt)
 {
     time_t currTime;
@@ -737,8 +3586,7 @@ DBData Database::getInputData(DataSource source, LogSample* samples, uint32_t co
         in->mediaLossRate = sqlite3_column_int(pStmt, 1);
         in->rate = sqlite3_column_int(pStmt, 2);
         in->samples = sqlite3_column_int(pStmt, 4);
-        memcpy(in->pcrArray, (float*)sqlite3_column_blob(pStmt, 3),
-            sizeof(float) * in->samples);
+        readPcr(pStmt, 3, in->pcrArray, in->samples);
         counter++;
     }
     return dbData;
@@ -773,8 +3621,7 @@ DBData Database::getOutputData(DataSource source, LogSample* samples, uint32_t c
         out->delayFactor = sqlite3_column_double(pStmt, 0);
         out->rate = sqlite3_column_int(pStmt, 1);
         out->samples = sqlite3_column_int(pStmt, 3);
-        memcpy(out->pcrArray, (float*)sqlite3_column_blob(pStmt, 2),
-            sizeof(float) * out->samples);
+        readPcr(pStmt, 2, out->pcrArray, out->samples);
         counter++;
     }
     return dbData;
@@ -841,6 +3688,98 @@ uint32_t Database::createLogEntryCSV(char* buffer, uint32_t bufferSize, time_t e
     return (result > 0) ? static_cast<uint32_t>(result) : 0;
 }
 
+bool Database::parseLogEntryCSV(const char* line, uint32_t length, time_t& entryTime, LogSample& sample)
+{
+    const char* p = line;
+    const char* end = line + length;
+    uint64_t value;
+
+    sample = LogSample();
+    if (!parseUInt(p, end, value))
+        return false;
+    entryTime = static_cast<time_t>(value);
+    if (!parseSeparator(p, end) || !parseUInt(p, end, value))
+        return false;
+    sample.activeInput = static_cast<uint32_t>(value);
+
+    // same order as in createLogEntryCSV
+#ifdef HIER_MODE_SUPPORTED
+    InputData* inputs[] = { &sample.hp1, &sample.lp1, &sample.hp2, &sample.lp2 };
+    OutputData* outputs[] = { &sample.hpOut, &sample.lpOut };
+#else
+    InputData* inputs[] = { &sample.hp1, &sample.hp2 };
+    OutputData* outputs[] = { &sample.hpOut };
+#endif
+    for (uint32_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+    {
+        InputData* in = inputs[i];
+        if (!parseSeparator(p, end) || !parseUInt(p, end, value))
+            return false;
+        in->rate = static_cast<uint32_t>(value);
+        if (!parseSeparator(p, end) || !parseFloat(p, end, in->delayFactor))
+            return false;
+        if (!parseSeparator(p, end) || !parseUInt(p, end, value))
+            return false;
+        in->mediaLossRate = static_cast<uint32_t>(value);
+        in->samples = 0; // PCR values are not in the CSV
+    }
+    for (uint32_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++)
+    {
+        OutputData* out = outputs[i];
+        if (!parseSeparator(p, end) || !parseUInt(p, end, value))
+            return false;
+        out->rate = static_cast<uint32_t>(value);
+        if (!parseSeparator(p, end) || !parseFloat(p, end, out->delayFactor))
+            return false;
+        out->samples = 0;
+    }
+    return true;
+}
+
+uint32_t Database::createLogHeaderBinary(char* buffer, uint32_t bufferSize)
+{
+    if (!buffer || bufferSize < dumpBinaryHeaderSize)
+        return 0;
+
+    memcpy(buffer, dumpBinaryMagic, sizeof(dumpBinaryMagic));
+    putUint32(putUint32(buffer + sizeof(dumpBinaryMagic), dumpBinaryRecordSize), dumpBinaryFlags);
+    return dumpBinaryHeaderSize;
+}
+
+uint32_t Database::createLogEntryBinary(char* buffer, uint32_t bufferSize, time_t entryTime,
+    const LogSample& sample)
+{
+    if (!buffer || bufferSize < dumpBinaryRecordSize)
+        return 0;
+
+    uint64_t recordTime = static_cast<int64_t>(entryTime);
+    char* p = putUint32(buffer, static_cast<uint32_t>(recordTime));
+    p = putUint32(p, static_cast<uint32_t>(recordTime >> 32));
+    p = putUint32(p, sample.activeInput);
+    p = putInput(p, sample.hp1);
+    p = putInput(p, sample.hp2);
+    p = putOutput(p, sample.hpOut);
+    p = putInput(p, sample.lp1);
+    p = putInput(p, sample.lp2);
+    putOutput(p, sample.lpOut);
+    return dumpBinaryRecordSize;
+}
+
+bool Database::parseLogEntryBinary(const char* record, time_t& entryTime, LogSample& sample)
+{
+    uint32_t low, high;
+    const char* p = getUint32(getUint32(record, low), high);
+    entryTime = static_cast<time_t>(static_cast<int64_t>((static_cast<uint64_t>(high) << 32) | low));
+    p = getUint32(p, sample.activeInput);
+    p = getInput(p, sample.hp1);
+    p = getInput(p, sample.hp2);
+    p = getOutput(p, sample.hpOut);
+    p = getInput(p, sample.lp1);
+    p = getInput(p, sample.lp2);
+    getOutput(p, sample.lpOut);
+    return true;
+}
+
 void Database::changePackSizeDEBUG(uint32_t packSize)
 {
     m_transPackSize = packSize;
@@ -4,7 +4,25 @@
 #include <iostream>
 #include <sstream>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <vector>
 #include "Defs.h"
+#include "DumpWriter.h"
+#include "DumpJob.h"
+#include "ChannelBlock.h"
+#include "BlockCache.h"
+#include "ReaderPool.h"
+#include "IngestQueue.h"
+#include "TaskPool.h"
+#include "LiveView.h"
+#include "LockProfiler.h"
+#include <condition_variable>
+#include <memory>
+#include <future>
+#include <thread>
+#include <map>
+#include <functional>
 //#include <variant>
 
 #define DEBUG
@@ -24,12 +42,162 @@ struct LogSample
 };
 
 
+/// sample queued for the writer thread
+struct IngestRecord
+{
+	uint32_t stream;
+	time_t time;
+	LogSample sample;
+};
+
+
 struct DBData
 {
 	time_t startTime;
 	uint32_t counter;
 };
 
+/**
+	DumpFormat
+*/
+enum DumpFormat
+{
+	DUMP_FORMAT_CSV = 0,	// readable, without PCR values
+	DUMP_FORMAT_BINARY		// raw samples with PCR values, for the restore on the same platform
+};
+
+/**
+	DumpOptions
+	Budget for the dump, the ingest has priority over it
+*/
+struct DumpOptions
+{
+	double rowsPerSec = 0;			// rows budget, 0 = unlimited
+	double bytesPerSec = 0;			// output budget, 0 = unlimited
+	uint32_t maxPendingWriters = 0;	// back off while more writers wait for the lock, 0 = off
+	double maxWriterLatency = 0;	// back off while the writes are slower (seconds), 0 = off
+	uint32_t backoffMs = 50;		// first backoff step, doubled while the pressure lasts
+	uint32_t maxBackoffMs = 1000;
+	DumpCompression compression = DUMP_COMPRESSION_NONE;
+	uint32_t compressThreads = 0;	// 0 = one per core
+	uint32_t blockSize = 1 << 20;	// bytes of CSV per compressed block
+	DumpFormat format = DUMP_FORMAT_CSV;
+	uint32_t stream = 0;
+};
+
+/**
+	StorageMode
+*/
+enum StorageMode
+{
+	STORAGE_ROWS = 0,	// one row per channel per second
+	STORAGE_CHUNKED		// one compressed row per channel per chunk of time
+};
+
+/**
+	PcrPrecision
+*/
+enum PcrPrecision
+{
+	PCR_FLOAT32 = 0,	// as measured
+	PCR_FLOAT16			// half precision (11 significant bits), half of the PCR storage
+};
+
+/**
+	DatabaseOptions
+*/
+struct DatabaseOptions
+{
+	StorageMode storage = STORAGE_ROWS;
+	uint32_t chunkSeconds = 3600;		// time span of one chunk
+	uint32_t chunkFlushSeconds = 60;	// the open chunk is saved after this many new seconds
+	PcrPrecision pcrPrecision = PCR_FLOAT32; // for the new data, both are read
+	uint32_t compactAfterSeconds = 0;	// row storage: rows this far behind the newest sample are
+										// moved to the chunks by the background compactor, 0 = never
+	uint32_t blockCacheSize = 32;		// decoded chunks kept for the repeated reads
+	uint32_t ingestQueueSize = 0;		// samples queued by enqueue() for the writer thread, 0 = enqueue() writes itself
+	IngestPolicy ingestPolicy = INGEST_BLOCK; // when the queue is full
+	uint32_t maintenanceThreads = 2;	// retention, compaction, dumps and file deletion (at least 2)
+	uint32_t channels = ~0u;			// DataSources stored in the file (bit per DataSource), see ShardedDatabase
+	uint32_t maxStreams = 1;			// stream ids 0..maxStreams-1, the streams other than 0 are kept in rows
+	uint32_t commitIntervalMs = 100;	// queued ingest: the samples of all the streams queued meanwhile
+										// are written in one transaction, 0 = as soon as they come
+	std::string liveViewName;			// shared memory with the last seconds of every stream (LiveViewReader),
+										// "/name"; empty = none
+	uint32_t liveViewSeconds = 60;
+	bool wal = false;					// WAL journal, checkpointed by a background task instead of the commits
+	uint32_t walCheckpointPages = 1000;	// WAL frames that start a passive checkpoint
+	uint32_t walCheckpointMs = 200;		// the checkpoints of a busy WAL are this far apart
+	uint32_t walTruncatePages = 4096;	// a larger WAL is truncated under the writer lock (the readers are waited for)
+	uint32_t queryThreads = 2;			// threads of the asynchronous reads (getAsync, aggregateAsync)
+	bool lockStats = false;				// wait and hold times of the lock per call site (getLockStats)
+	uint32_t partitionSeconds = 0;		// rows: tables of their own per span of time, the retention drops whole
+										// partitions (the oldest one once every stream keeps the limit without
+										// it); 0 = one table per channel. Under 500 partitions in the retention
+	bool partitionFiles = false;		// with partitionSeconds: each partition in a file of its own next to the
+										// database ("name_<start>.db"), attached while it is read; the expired
+										// files are deleted in the background
+};
+
+/**
+	WalStats
+*/
+struct WalStats
+{
+	uint32_t walPages = 0;				// frames in the WAL after the last commit
+	uint64_t checkpoints = 0;
+	uint64_t truncations = 0;			// escalated checkpoints
+	uint64_t framesCheckpointed = 0;
+	double lastDuration = 0;			// seconds
+	double maxDuration = 0;
+};
+
+/**
+	ScanFilter
+	A second matches when any of the used conditions holds
+*/
+struct ScanFilter
+{
+	double delayFactorAbove = -1;	// delayFactor > value, < 0 = not used
+	int64_t mediaLossAbove = -1;	// mediaLossRate > value (inputs), < 0 = not used
+	int64_t rateBelow = -1;			// rate < value, < 0 = not used
+	int64_t rateAbove = -1;			// rate > value, < 0 = not used
+};
+
+/**
+	ScanStats
+*/
+struct ScanStats
+{
+	uint32_t blocks = 0;			// chunks in the range
+	uint32_t blocksSkipped = 0;		// not read thanks to their zone maps
+	uint64_t samplesRead = 0;
+	uint64_t matches = 0;
+};
+
+/// scan callback: data is InputData or OutputData of the source, false stops the scan
+typedef bool (*ScanCallback)(DataSource source, time_t time, const void* data, void* param);
+
+/**
+	AggregateResult
+	Summary of one channel over a range of time
+*/
+struct AggregateResult
+{
+	uint64_t count = 0;				// seconds in the range
+	BlockSummary summary = {};		// when count > 0; the media loss of the inputs only
+	uint32_t blocks = 0;			// chunks in the range
+	uint32_t blocksSummarized = 0;	// taken from their zone maps, not decoded
+};
+
+/// completion callbacks of the asynchronous reads, called from a query thread; called at once
+/// with no samples (an empty result) when the query threads are stopped
+typedef void (*GetCallback)(const LogSample* samples, uint32_t count, time_t startTime, void* param);
+typedef void (*AggregateCallback)(const AggregateResult& result, void* param);
+
+/// backup progress callback: pages left to copy and total pages of the source
+typedef void (*BackupCallback)(uint32_t remaining, uint32_t total, void* param);
+
 
 class Database
 {
@@ -37,14 +205,104 @@ class Database
 private:
 	sqlite3* m_pDb;	
 	uint32_t m_atomicDumpSize;
-	std::mutex m_DbMutex;
+	std::shared_timed_mutex m_DbMutex; // exclusive for the writers, shared for the readers
+	ReaderPool m_readers; // connections of the readers
+	LiveViewWriter m_liveView;
 	uint32_t m_transPackSize;
 	uint32_t m_limit;
 	std::string m_dbFileName;
-	std::string m_dbEmptyFileName;
+	std::string m_dbEmptyFileName; // template of clear(), the empty tables
+	std::atomic<uint32_t> m_pendingWriters; // writers waiting for or holding the lock
+	std::mutex m_writerGate;				// the readers waiting for a queued writer
+	std::condition_variable m_writerGateCond;
+	uint64_t m_writesDone;					// under m_writerGate
+	std::atomic<double> m_writerLatency;	// average time the writes hold the lock (seconds)
+	std::atomic<uint64_t> m_lastWrite;		// LockProfiler::now() of the last write
+	LockProfiler m_lockProfiler;
+	uint64_t m_writeAcquired; // the writer's lock timing (lockStats), 0 = not profiled
+	uint64_t m_writeWait;
+	bool m_writeContended;
+	LockSite m_writeSite;
+	struct ReadLockTiming
+	{
+		uint64_t acquired;
+		uint64_t wait;
+		bool contended;
+		LockSite site;
+	};
+	std::map<sqlite3*, ReadLockTiming> m_readTimings; // the readers' lock timing (lockStats), by connection
+	std::mutex m_readTimingsMutex;
+	std::unique_ptr<std::atomic<uint32_t>[]> m_totalSamples; // per stream, updated by the writers, read without the lock
+	std::unique_ptr<std::atomic<time_t>[]> m_startTime;
+	std::vector<std::shared_ptr<DumpJob>> m_dumpJobs; // running asynchronous dumps
+	std::mutex m_dumpJobsMutex;
+	std::condition_variable m_dumpJobsCond;
+	DatabaseOptions m_options;
+	DataSource m_refSource; // first stored channel: the time and the count of the samples
+	std::vector<ChannelBlock> m_openChunk; // newest chunk per DataSource (chunked storage)
+	time_t m_openChunkTime;
+	uint32_t m_openChunkSaved; // samples of the open chunk already in the database
+	std::atomic<uint64_t> m_rejectedSamples; // out of order or duplicate, not stored by the chunks
+	bool m_compacted; // row storage: the chunk tables may hold compacted rows
+	std::vector<time_t> m_partitions; // time partitions of the rows, oldest first (partitionSeconds)
+	time_t m_insertPartition; // partition of the cached insert statements, -1 = none
+	time_t m_prevPartition; // the insert partition before it, its statements (and file) kept, -1 = none
+	time_t m_newestTime; // newest row, for the compaction of the partitions
+	struct PartitionRows
+	{
+		std::vector<uint32_t> count;	// per stream
+		std::vector<time_t> startTime;
+	};
+	std::map<time_t, PartitionRows> m_partitionRows; // partitions other than the insert ones, counted once
+	BlockCache m_blockCache;
+	TaskPool m_tasks; // maintenance off the ingest path
+	TaskPool m_queries; // asynchronous reads
+	std::shared_ptr<PoolTask> m_retentionTask;
+	std::shared_ptr<PoolTask> m_compactTask; // moves cold rows to the chunks (row storage)
+	std::shared_ptr<PoolTask> m_checkpointTask; // WAL checkpoints, submitted by the commits
+	sqlite3* m_checkpointDb; // connection of the checkpoints, the writer's one is not held meanwhile
+	std::mutex m_checkpointMutex; // the checkpoint connection (after m_DbMutex)
+	std::atomic<uint32_t> m_walPages;
+	uint32_t m_walBackfilled; // frames of the WAL checkpointed so far (m_checkpointMutex)
+	uint32_t m_clears; // suffix of the files deleted by clear()
+	uint32_t m_backups; // backups between their steps (writer lock): the live file is kept
+	WalStats m_walStats;
+	mutable std::mutex m_walStatsMutex;
+	/// prepared statements of the ingest path, kept until the connection is closed
+	enum StatementId
+	{
+		STMT_BEGIN = 0,
+		STMT_COMMIT,
+		STMT_COUNT_ROWS,
+		STMT_FIRST_CHUNK,
+		STMT_START_ROWS,
+		STMT_START_CHUNKS,
+		STMT_INSERT,										// one per DataSource
+		STMT_DELETE_FIRST = STMT_INSERT + DS_COUNT,			// one per DataSource
+		STMT_COUNT_CHUNKS = STMT_DELETE_FIRST + DS_COUNT,	// one per DataSource
+		STMT_WRITE_CHUNK = STMT_COUNT_CHUNKS + DS_COUNT,	// one per DataSource
+		STMT_DELETE_CHUNK = STMT_WRITE_CHUNK + DS_COUNT,	// one per DataSource
+		STMT_TOTAL = STMT_DELETE_CHUNK + DS_COUNT
+	};
+	sqlite3_stmt* m_statements[STMT_TOTAL];
+	/// the insert statements of m_prevPartition (by DataSource), then its STMT_COUNT_ROWS
+	sqlite3_stmt* m_prevStatements[DS_COUNT + 1];
+	std::vector<uint8_t> m_chunkData; // encoded chunk being written
+	/// queued ingest: the producers only copy the sample, one thread writes them
+	std::unique_ptr<IngestQueue<IngestRecord>> m_ingestQueue;
+	std::thread m_ingestThread;
+	std::mutex m_ingestMutex;
+	std::condition_variable m_ingestCond;
+	std::atomic<bool> m_ingestStop;
+	std::atomic<bool> m_ingestIdle;	// the writer thread waits for the records
+	std::atomic<bool> m_ingestBusy;	// the writer thread has records not written yet
+	std::atomic<uint32_t> m_ingestFlushes;	// flushIngest calls waiting, no commit interval then
+	std::atomic<uint64_t> m_ingestWritten;
+	std::vector<uint32_t> m_streamAdded;	// samples of the group commit per stream
+	std::vector<uint32_t> m_touchedStreams;
 public:
 	 
-	Database(const std::string& fileName, bool bRecreate);
+	Database(const std::string& fileName, bool bRecreate, const DatabaseOptions& options = DatabaseOptions());
 	~Database();
 	bool open(const std::string& fileName, bool bRecreate);
 	void close();
@@ -55,24 +313,158 @@ public:
 	bool verifyIntegrity();	
 	void add(time_t startTime, const LogSample* samples, uint32_t count);
 	void addT(time_t startTime, const LogSample* samples, uint32_t count);
+	/// one sample of a producer thread: queued for the writer thread when the queue is on,
+	/// false when it was dropped (DatabaseOptions::ingestPolicy)
+	bool enqueue(time_t time, const LogSample& sample);
+	/// the same for one of the streams (DatabaseOptions::maxStreams), the calls above are stream 0;
+	/// the retention keeps the limit per stream
+	time_t getStartTime(uint32_t stream);
+	uint32_t getTotalSamples(uint32_t stream);
+	void add(uint32_t stream, time_t startTime, const LogSample* samples, uint32_t count);
+	void addT(uint32_t stream, time_t startTime, const LogSample* samples, uint32_t count);
+	bool enqueue(uint32_t stream, time_t time, const LogSample& sample);
+	/// firstTime: the time of the first sample returned
+	uint32_t get(uint32_t stream, LogSample* samples, uint32_t count, time_t startTime, time_t* firstTime = NULL);
+	/// waits until the samples queued so far are written
+	void flushIngest();
+	uint64_t getIngestWritten() const;
+	uint64_t getIngestDropped() const;
+	/// samples of the chunked storage (stream 0) not newer than the last stored one, they are skipped
+	uint64_t getRejectedSamples() const;
+	/// false when DatabaseOptions::liveViewName is taken by a running writer (or none is set)
+	bool hasLiveView() const;
 	uint32_t get(LogSample* samples, uint32_t count, time_t startTime);
-	void clear();
-	void clearFake(std::ofstream& fs);
-	bool dump(const std::string& fileName);
+	/// PCR values of one channel (stream 0): the values of all seconds packed, offsets[i] is the position
+	/// of the first value of second i (one entry per second). Returns the number of seconds
+	uint32_t getPcr(DataSource source, time_t startTime, uint32_t count,
+					std::vector<float>& values, std::vector<uint32_t>& offsets);
+	/// seconds of one channel (stream 0) in [startTime, endTime] matching the filter, oldest first;
+	/// the chunks whose zone maps cannot match are not read. Returns the number of matches
+	uint64_t scan(DataSource source, time_t startTime, time_t endTime, const ScanFilter& filter,
+				  ScanCallback cb, void* userParam, ScanStats* stats = NULL);
+	/// summary of one channel (stream 0) in [startTime, endTime]: the chunks entirely in the
+	/// range are taken from their zone maps, the rest is read
+	bool aggregate(DataSource source, time_t startTime, time_t endTime, AggregateResult& result);
+	/// the reads on the query threads (DatabaseOptions::queryThreads), shared by all the requests;
+	/// they complete through the future or the callback (with no samples, an empty result or false
+	/// when the query threads are stopped)
+	std::future<std::vector<LogSample>> getAsync(time_t startTime, uint32_t count, uint32_t stream = 0);
+	void getAsync(time_t startTime, uint32_t count, uint32_t stream, GetCallback cb, void* userParam);
+	std::future<AggregateResult> aggregateAsync(DataSource source, time_t startTime, time_t endTime);
+	void aggregateAsync(DataSource source, time_t startTime, time_t endTime, AggregateCallback cb, void* userParam);
+	std::future<bool> verifyIntegrityAsync();
+	/// the live files are replaced by a copy of the empty template, the old ones are deleted in the background
+	/// (during a backup the tables are dropped in the live file); false when the database is left closed
+	bool clear();
+	bool dump(const std::string& fileName, const DumpOptions& options = DumpOptions());
+	/// startDump with the result as a future
+	std::shared_future<bool> dumpAsync(const std::string& fileName, const DumpOptions& options = DumpOptions());
+	/// asynchronous dump, the handle reports the progress and can cancel it
+	std::shared_ptr<DumpJob> startDump(const std::string& fileName, const DumpOptions& options = DumpOptions(),
+									   DumpCallback cb = NULL, void* userParam = NULL);
+	/// online backup: copies pagesPerStep pages at a time, the lock is released between the steps;
+	/// false with DatabaseOptions::partitionFiles, the file would not hold the rows
+	bool backup(const std::string& fileName, int pagesPerStep, uint32_t pauseMs,
+				BackupCallback cb = NULL, void* userParam = NULL);
+	/// restore a dump (CSV or binary, plain or compressed), the samples are appended
+	bool import(const std::string& fileName);
+	/// timing of the maintenance tasks, per kind
+	std::vector<TaskStats> getMaintenanceStats() const;
+	/// WAL size and the checkpoints so far (DatabaseOptions::wal)
+	WalStats getWalStats() const;
+	/// lock contention per call site, the sites that took the lock (DatabaseOptions::lockStats)
+	std::vector<LockSiteStats> getLockStats() const;
+	void resetLockStats();
+	void enableLockStats(bool enable);
 	void changePackSizeDEBUG(uint32_t packSize); // TODO back to private
 private:
 	
 	bool deleteFirstSample();
-	bool deleteFirstNSamples(uint32_t n);
+	bool deleteFirstNSamples(uint32_t stream, uint32_t n);
 
-	uint32_t internalGet(LogSample* samples, uint32_t count, time_t& startTime);	
-	void addToInput(time_t currTime, const LogSample& sample);
-	void addToOutput(time_t currTime, const LogSample& sample);
-	void addToInputT(time_t currTime, const LogSample* samples, uint32_t count);
-	void addToOutputT(time_t currTime, const LogSample* samples, uint32_t count);
+	uint32_t internalGet(uint32_t stream, LogSample* samples, uint32_t count, time_t& startTime);	
+	bool isStored(DataSource source) const;
+	/// the writers: one at a time, the new readers wait while one is queued
+	void beginWrite(LockSite site);
+	void endWrite();
+	/// the readers: shared lock and a connection of their own, NULL when the database is closed
+	sqlite3* beginRead(LockSite site);
+	void endRead(sqlite3* db);
+	void updateCounters(uint32_t stream);
+	void updateAllCounters();
+	time_t internalGetStartTime(uint32_t stream);
+	void addToInput(uint32_t stream, time_t currTime, const LogSample& sample);
+	void addToOutput(uint32_t stream, time_t currTime, const LogSample& sample);
+	void addToInputT(uint32_t stream, time_t currTime, const LogSample* samples, uint32_t count);
+	void addToOutputT(uint32_t stream, time_t currTime, const LogSample* samples, uint32_t count);
 	void createEmptyDb();	
-	uint32_t internalGetTotalSamples(); // total number of samples	
+	bool internalOpen(const std::string& fileName, bool bRecreate);
+	bool internalClose();
+	bool swapInEmptyDb();
+	void clearTables();
+	sqlite3_stmt* getStatement(uint32_t id);
+	void execStatement(uint32_t id);
+	void finalizeStatements();
+	void recordWrite(double duration);
+	double getWriterLatency() const;
+	void waitForIngest(const DumpOptions& options, const DumpJob* job);
+	bool runDump(const std::string& fileName, const DumpOptions& options, DumpJob* job);
+	void cancelDumps();
+	void insertBulk(time_t startTime, const LogSample* samples, uint32_t count);
+	/// chunked storage
+	uint32_t addChunked(time_t startTime, const LogSample* samples, uint32_t count);
+	void saveOpenChunk();
+	void writeChunk(DataSource source, time_t chunkTime, const ChannelBlock& block);
+	void loadOpenChunk();
+	std::shared_ptr<const ChannelBlock> readChunk(DataSource source, time_t chunkTime, sqlite3* db = NULL);
+	uint32_t internalGetChunked(LogSample* samples, uint32_t count, time_t& startTime, sqlite3* db);
+	bool findChunk(time_t startTime, time_t& chunkTime, sqlite3* db);
+	uint32_t internalGetPcr(DataSource source, time_t& startTime, uint32_t count,
+							std::vector<float>& values, std::vector<uint32_t>& offsets, sqlite3* db);
+	bool usesChunks() const;
+	uint32_t getChunkedTotalSamples(DataSource source);
+	void applyChunkRetention();
+	/// the retention runs in the pool after the writes
+	void scheduleRetention();
+	void applyRetention();
+	uint32_t deleteFirstChunks(uint32_t n);
+	/// time partitions of the rows
+	bool isPartitioned() const;
+	bool usesPartitionFiles() const;
+	std::string getPartitionTable(DataSource source, time_t partitionTime) const;
+	std::string getPartitionFileName(time_t partitionTime) const;
+	bool attachPartition(sqlite3* db, time_t partitionTime);
+	void detachPartition(sqlite3* db, time_t partitionTime);
+	bool forEachPartitionGroup(sqlite3* db, time_t startTime, time_t endTime,
+							   const std::function<bool(time_t, time_t)>& fn);
+	void countPartitionRows(time_t partitionTime, uint32_t stream, uint32_t& count, time_t& startTime);
+	std::vector<time_t> findPartitions();
+	std::vector<time_t> findPartitionFiles() const;
+	void loadPartitions();
+	void usePartition(time_t time);
+	void createPartition(time_t partitionTime);
+	void dropPartition(time_t partitionTime);
+	bool applyPartitionRetention();
+	void deletePartitionRows(time_t partitionTime, uint32_t stream);
+	void resetRowStatements();
+	void swapPartitionStatements();
+	void releasePrevPartition();
+	/// the row tables holding [startTime, endTime], or one FROM source over them
+	std::vector<std::string> getRowTables(DataSource source, time_t startTime, time_t endTime) const;
+	std::string getRowSource(DataSource source, time_t startTime, time_t endTime) const;
+	/// background compaction of the cold rows
+	void compactTaskFunc(PoolTask& task);
+	bool compactOldestChunk();
+	/// background checkpoints of the WAL
+	static int walHook(void* param, sqlite3*, const char*, int pages);
+	void checkpointTaskFunc();
+	/// writer thread of the queued ingest
+	void ingestThreadFunc();
+	uint32_t drainIngest();
+	void stopIngest();
+	uint32_t internalGetTotalSamples(uint32_t stream); // total number of samples	
 	void* getSample(LogSample& sample, DataSource source);
+	const void* getSample(const LogSample& sample, DataSource source) const;
 	//InputData* getSampleIn(LogSample& sample, DataSource source);
 	//OutputData* getSampleOut(LogSample& sample, DataSource source);
 	DBData getInputData(DataSource source, LogSample* samples, uint32_t count, sqlite3_stmt* pStmt);
@@ -83,6 +475,15 @@ private:
 	/// create log entry (CSV)
 	static uint32_t createLogEntryCSV(char* buffer, uint32_t bufferSize, time_t entryTime,
 									  const LogSample& sample);
+	/// parse log entry (CSV)
+	static bool parseLogEntryCSV(const char* line, uint32_t length, time_t& entryTime, LogSample& sample);
+	/// create log header (binary)
+	static uint32_t createLogHeaderBinary(char* buffer, uint32_t bufferSize);
+	/// create log entry (binary)
+	static uint32_t createLogEntryBinary(char* buffer, uint32_t bufferSize, time_t entryTime,
+										 const LogSample& sample);
+	/// parse log entry (binary), the record has the size of the header
+	static bool parseLogEntryBinary(const char* record, time_t& entryTime, LogSample& sample);
 
 	//static bool saveLogCSV(FILE* f, time_t startTime, const LogData& data);		
 };
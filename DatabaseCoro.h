@@ -0,0 +1,135 @@
+#ifndef DATABASE_CORO_H
+#define DATABASE_CORO_H
+
+#include "Database.h"
+
+/**
+    C++20 coroutine adapter of the asynchronous reads:
+
+        std::vector<LogSample> samples = co_await getCo(database, startTime, count);
+
+    The coroutine is resumed on the query thread that has completed the read, or goes on in its
+    own thread when the read is over before it is suspended. The database must not be destroyed
+    by a coroutine resumed on a query thread: its destructor waits for that thread.
+    Empty with the older standards
+*/
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <atomic>
+#include <coroutine>
+
+/**
+    GetAwaiter
+*/
+class GetAwaiter
+{
+    private:
+        Database&                   m_database;
+        time_t                      m_startTime;
+        uint32_t                    m_count;
+        uint32_t                    m_stream;
+        std::vector<LogSample>      m_samples;
+        std::coroutine_handle<>     m_handle;
+        std::atomic<bool>           m_done;     // set by the first of the completion and the suspension
+
+    public:
+        GetAwaiter(Database& database, time_t startTime, uint32_t count, uint32_t stream)
+            : m_database( database ),
+              m_startTime( startTime ),
+              m_count( count ),
+              m_stream( stream ),
+              m_done( false )
+        {
+        }
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_database.getAsync(m_startTime, m_count, m_stream, &GetAwaiter::completed, this);
+            return !m_done.exchange(true);
+        }
+
+        std::vector<LogSample> await_resume()
+        {
+            return std::move(m_samples);
+        }
+
+    private:
+        static void completed(const LogSample* samples, uint32_t count, time_t startTime, void* param)
+        {
+            GetAwaiter* awaiter = static_cast<GetAwaiter*>(param);
+            awaiter->m_samples.assign(samples, samples + count);
+            if (awaiter->m_done.exchange(true))
+                awaiter->m_handle.resume();
+        }
+};
+
+/**
+    AggregateAwaiter
+*/
+class AggregateAwaiter
+{
+    private:
+        Database&                   m_database;
+        DataSource                  m_source;
+        time_t                      m_startTime;
+        time_t                      m_endTime;
+        AggregateResult             m_result;
+        std::coroutine_handle<>     m_handle;
+        std::atomic<bool>           m_done;     // set by the first of the completion and the suspension
+
+    public:
+        AggregateAwaiter(Database& database, DataSource source, time_t startTime, time_t endTime)
+            : m_database( database ),
+              m_source( source ),
+              m_startTime( startTime ),
+              m_endTime( endTime ),
+              m_done( false )
+        {
+        }
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_database.aggregateAsync(m_source, m_startTime, m_endTime, &AggregateAwaiter::completed, this);
+            return !m_done.exchange(true);
+        }
+
+        AggregateResult await_resume()
+        {
+            return m_result;
+        }
+
+    private:
+        static void completed(const AggregateResult& result, void* param)
+        {
+            AggregateAwaiter* awaiter = static_cast<AggregateAwaiter*>(param);
+            awaiter->m_result = result;
+            if (awaiter->m_done.exchange(true))
+                awaiter->m_handle.resume();
+        }
+};
+
+inline GetAwaiter getCo(Database& database, time_t startTime, uint32_t count, uint32_t stream = 0)
+{
+    return GetAwaiter(database, startTime, count, stream);
+}
+
+inline AggregateAwaiter aggregateCo(Database& database, DataSource source, time_t startTime, time_t endTime)
+{
+    return AggregateAwaiter(database, source, startTime, endTime);
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // DATABASE_CORO_H
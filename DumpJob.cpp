@@ -0,0 +1,123 @@
+#include "DumpJob.h"
+
+
+/**
+    DumpJob
+*/
+DumpJob::DumpJob(const std::string& fileName, DumpCallback cb, void* userParam)
+    : m_fileName( fileName )
+    , m_rowsDone( 0 )
+    , m_rowsTotal( 0 )
+    , m_bytesWritten( 0 )
+    , m_cancelled( false )
+    , m_state( DUMP_JOB_RUNNING )
+    , m_timer( true )
+    , m_totalTime( 0 )
+    , m_future( m_promise.get_future().share() )
+    , m_cb( cb )
+    , m_param( userParam )
+{
+}
+DumpJob::~DumpJob()
+{
+}
+
+/// progress
+const std::string& DumpJob::getFileName() const
+{
+    return m_fileName;
+}
+
+uint64_t DumpJob::getRowsDone() const
+{
+    return m_rowsDone;
+}
+
+uint64_t DumpJob::getRowsTotal() const
+{
+    // the database keeps growing while the dump runs
+    uint64_t rowsDone = m_rowsDone;
+    uint64_t rowsTotal = m_rowsTotal;
+    return (rowsDone > rowsTotal) ? rowsDone : rowsTotal;
+}
+
+uint64_t DumpJob::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+double DumpJob::getElapsed() const
+{
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    return m_timer.isRunning() ? m_timer.getRunningTime() : m_totalTime;
+}
+
+double DumpJob::getEta() const
+{
+    if (isFinished())
+        return 0.0;
+
+    uint64_t rowsDone = m_rowsDone;
+    double elapsed = getElapsed();
+    if (rowsDone == 0 || elapsed <= 0)
+        return -1.0;
+
+    double rate = rowsDone / elapsed;
+    return (getRowsTotal() - rowsDone) / rate;
+}
+
+DumpJobState DumpJob::getState() const
+{
+    return static_cast<DumpJobState>(m_state.load());
+}
+
+bool DumpJob::isFinished() const
+{
+    return (getState() != DUMP_JOB_RUNNING);
+}
+
+/// cancel the dump
+void DumpJob::cancel()
+{
+    m_cancelled = true;
+}
+
+bool DumpJob::isCancelled() const
+{
+    return m_cancelled;
+}
+
+/// completion
+std::shared_future<bool> DumpJob::getFuture() const
+{
+    return m_future;
+}
+
+bool DumpJob::wait() const
+{
+    return m_future.get();
+}
+
+/// called by the dump
+void DumpJob::setTotal(uint64_t rowsTotal)
+{
+    m_rowsTotal = rowsTotal;
+}
+
+void DumpJob::addProgress(uint64_t rows, uint64_t bytesWritten)
+{
+    m_rowsDone += rows;
+    m_bytesWritten = bytesWritten;
+}
+
+void DumpJob::finish(bool result)
+{
+    m_timerMutex.lock();
+    m_totalTime = m_timer.stop();
+    m_timerMutex.unlock();
+
+    m_state = result ? DUMP_JOB_DONE : (m_cancelled ? DUMP_JOB_CANCELLED : DUMP_JOB_FAILED);
+    if (m_cb)
+        m_cb(*this, result, m_param);
+    m_promise.set_value(result);
+}
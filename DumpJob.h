@@ -0,0 +1,78 @@
+#ifndef DUMP_JOB_H
+#define DUMP_JOB_H
+
+#include "Platform.h"
+#include "Timer.h"
+#include <atomic>
+#include <future>
+#include <mutex>
+
+class DumpJob;
+
+/// completion callback: called once from the dump thread (from startDump when the dump can't be started)
+typedef void (*DumpCallback)(DumpJob& job, bool result, void* param);
+
+/**
+    DumpJobState
+*/
+enum DumpJobState
+{
+    DUMP_JOB_RUNNING = 0,
+    DUMP_JOB_DONE,
+    DUMP_JOB_FAILED,
+    DUMP_JOB_CANCELLED
+};
+
+/**
+    DumpJob
+    Handle of the asynchronous dump: progress, cancellation and completion
+*/
+class DumpJob
+{
+    friend class Database;
+
+    private:
+        std::string                 m_fileName;
+        std::atomic<uint64_t>       m_rowsDone;
+        std::atomic<uint64_t>       m_rowsTotal;
+        std::atomic<uint64_t>       m_bytesWritten;
+        std::atomic<bool>           m_cancelled;
+        std::atomic<int>            m_state;
+        Timer                       m_timer;
+        double                      m_totalTime;
+        mutable std::mutex          m_timerMutex;
+        std::promise<bool>          m_promise;
+        std::shared_future<bool>    m_future;
+        DumpCallback                m_cb;
+        void*                       m_param;
+
+    public:
+        DumpJob(const std::string& fileName, DumpCallback cb, void* userParam);
+        ~DumpJob();
+
+        /// progress
+        const std::string&  getFileName() const;
+        uint64_t            getRowsDone() const;
+        uint64_t            getRowsTotal() const;
+        uint64_t            getBytesWritten() const;
+        double              getElapsed() const;
+        double              getEta() const;     // seconds, < 0 if unknown
+        DumpJobState        getState() const;
+        bool                isFinished() const;
+
+        /// cancel the dump, it stops before the next chunk
+        void                cancel();
+        bool                isCancelled() const;
+
+        /// completion
+        std::shared_future<bool>    getFuture() const;
+        bool                        wait() const;
+
+    private:
+        /// called by the dump
+        void                setTotal(uint64_t rowsTotal);
+        void                addProgress(uint64_t rows, uint64_t bytesWritten);
+        void                finish(bool result);
+};
+
+#endif // DUMP_JOB_H
@@ -0,0 +1,263 @@
+#include "DumpReader.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef DUMP_GZIP_SUPPORTED
+    #include <zlib.h>
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    #include <zstd.h>
+#endif
+
+/// read buffer size
+static const size_t bufferSize = 1 << 20;
+
+
+/**
+    DumpReader
+*/
+DumpReader::DumpReader()
+    : m_file( NULL )
+    , m_gzFile( NULL )
+    , m_zstdStream( NULL )
+    , m_compression( DUMP_COMPRESSION_NONE )
+    , m_inputPos( 0 )
+    , m_inputSize( 0 )
+    , m_pos( 0 )
+    , m_size( 0 )
+    , m_eof( false )
+    , m_failed( false )
+{
+}
+DumpReader::~DumpReader()
+{
+    close();
+}
+
+/// open/close
+bool DumpReader::open(const std::string& fileName)
+{
+    close();
+
+    m_file = fopen(fileName.c_str(), "rb");
+    if (!m_file)
+        return false;
+
+    unsigned char magic[4] = { 0 };
+    size_t magicSize = fread(magic, 1, sizeof(magic), m_file);
+    rewind(m_file);
+
+    m_compression = DUMP_COMPRESSION_NONE;
+    if (magicSize >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        m_compression = DUMP_COMPRESSION_GZIP;
+    else if (magicSize == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        m_compression = DUMP_COMPRESSION_ZSTD;
+
+    if (!DumpWriter::isSupported(m_compression))
+    {
+        close();
+        return false;
+    }
+
+#ifdef DUMP_GZIP_SUPPORTED
+    if (m_compression == DUMP_COMPRESSION_GZIP)
+    {
+        // gzread goes through all the concatenated members
+        m_gzFile = gzopen(fileName.c_str(), "rb");
+        if (!m_gzFile)
+        {
+            close();
+            return false;
+        }
+        gzbuffer(static_cast<gzFile>(m_gzFile), bufferSize);
+    }
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    if (m_compression == DUMP_COMPRESSION_ZSTD)
+    {
+        ZSTD_DStream* stream = ZSTD_createDStream();
+        if (!stream || ZSTD_isError(ZSTD_initDStream(stream)))
+        {
+            ZSTD_freeDStream(stream);
+            close();
+            return false;
+        }
+        m_zstdStream = stream;
+        m_input.resize(ZSTD_DStreamInSize());
+    }
+#endif
+
+    m_buffer.resize(bufferSize);
+    return true;
+}
+
+void DumpReader::close()
+{
+#ifdef DUMP_GZIP_SUPPORTED
+    if (m_gzFile)
+        gzclose(static_cast<gzFile>(m_gzFile));
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    if (m_zstdStream)
+        ZSTD_freeDStream(static_cast<ZSTD_DStream*>(m_zstdStream));
+#endif
+    if (m_file)
+        fclose(m_file);
+
+    m_file = NULL;
+    m_gzFile = NULL;
+    m_zstdStream = NULL;
+    m_inputPos = m_inputSize = 0;
+    m_pos = m_size = 0;
+    m_eof = false;
+    m_failed = false;
+}
+
+bool DumpReader::isOpen() const
+{
+    return (m_file != NULL);
+}
+
+bool DumpReader::isFailed() const
+{
+    return m_failed;
+}
+
+DumpCompression DumpReader::getCompression() const
+{
+    return m_compression;
+}
+
+/// read exactly size bytes
+bool DumpReader::read(void* data, uint32_t size)
+{
+    char* dst = static_cast<char*>(data);
+    while (size > 0)
+    {
+        if (m_pos == m_size && !fill())
+            return false;
+
+        size_t part = std::min<size_t>(size, m_size - m_pos);
+        memcpy(dst, &m_buffer[m_pos], part);
+        m_pos += part;
+        dst += part;
+        size -= static_cast<uint32_t>(part);
+    }
+    return true;
+}
+
+/// next line without the line feed
+bool DumpReader::readLine(const char*& line, uint32_t& length)
+{
+    size_t searchPos = m_pos;
+    while (true)
+    {
+        const char* begin = &m_buffer[0] + m_pos;
+        const char* found = static_cast<const char*>(memchr(&m_buffer[0] + searchPos, '\n', m_size - searchPos));
+        if (found)
+        {
+            line = begin;
+            length = static_cast<uint32_t>(found - begin);
+            m_pos = found - &m_buffer[0] + 1;
+            if (length > 0 && line[length - 1] == '\r')
+                length--;
+            return true;
+        }
+
+        searchPos = m_size - m_pos;
+        if (!fill())
+        {
+            // the last line without the line feed
+            if (m_pos == m_size)
+                return false;
+            line = &m_buffer[0] + m_pos;
+            length = static_cast<uint32_t>(m_size - m_pos);
+            m_pos = m_size;
+            return true;
+        }
+    }
+}
+
+/// look at the first bytes
+uint32_t DumpReader::peek(void* data, uint32_t size)
+{
+    while (m_size - m_pos < size && fill())
+        ;
+    size_t part = std::min<size_t>(size, m_size - m_pos);
+    if (part)
+        memcpy(data, &m_buffer[m_pos], part);
+    return static_cast<uint32_t>(part);
+}
+
+/// helpers
+// keep the unread tail at the front of the buffer and read more after it
+bool DumpReader::fill()
+{
+    if (m_eof || !m_file)
+        return false;
+
+    if (m_pos > 0)
+    {
+        memmove(&m_buffer[0], &m_buffer[m_pos], m_size - m_pos);
+        m_size -= m_pos;
+        m_pos = 0;
+    }
+    if (m_size == m_buffer.size())
+        m_buffer.resize(m_buffer.size() * 2);
+
+    size_t result = readRaw(&m_buffer[m_size], m_buffer.size() - m_size);
+    if (result == 0)
+    {
+        m_eof = true;
+        return false;
+    }
+    m_size += result;
+    return true;
+}
+
+size_t DumpReader::readRaw(char* data, size_t size)
+{
+    switch (m_compression)
+    {
+    default:
+    case DUMP_COMPRESSION_NONE:
+        return fread(data, 1, size, m_file);
+#ifdef DUMP_GZIP_SUPPORTED
+    case DUMP_COMPRESSION_GZIP:
+    {
+        int result = gzread(static_cast<gzFile>(m_gzFile), data, static_cast<unsigned>(size));
+        if (result < 0)
+        {
+            m_failed = true;
+            return 0;
+        }
+        return result;
+    }
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    case DUMP_COMPRESSION_ZSTD:
+    {
+        ZSTD_outBuffer output = { data, size, 0 };
+        while (output.pos == 0)
+        {
+            if (m_inputPos == m_inputSize)
+            {
+                m_inputSize = fread(&m_input[0], 1, m_input.size(), m_file);
+                m_inputPos = 0;
+                if (m_inputSize == 0)
+                    break;
+            }
+            ZSTD_inBuffer input = { &m_input[0], m_inputSize, m_inputPos };
+            size_t result = ZSTD_decompressStream(static_cast<ZSTD_DStream*>(m_zstdStream), &output, &input);
+            m_inputPos = input.pos;
+            if (ZSTD_isError(result))
+            {
+                m_failed = true;
+                return 0;
+            }
+        }
+        return output.pos;
+    }
+#endif
+    }
+}
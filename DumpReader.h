@@ -0,0 +1,53 @@
+#ifndef DUMP_READER_H
+#define DUMP_READER_H
+
+#include "Platform.h"
+#include "DumpWriter.h"
+#include <vector>
+
+/**
+    DumpReader
+    Sequential reader for the files made by DumpWriter: plain, gzip or zstd
+    (the format is detected by the file magic)
+*/
+class DumpReader
+{
+    private:
+        FILE*               m_file;
+        void*               m_gzFile;       // gzFile
+        void*               m_zstdStream;   // ZSTD_DStream
+        DumpCompression     m_compression;
+        std::vector<char>   m_input;        // compressed input (zstd)
+        size_t              m_inputPos;
+        size_t              m_inputSize;
+        std::vector<char>   m_buffer;       // decompressed data
+        size_t              m_pos;
+        size_t              m_size;
+        bool                m_eof;
+        bool                m_failed;
+
+    public:
+        DumpReader();
+        ~DumpReader();
+
+        /// open/close
+        bool        open(const std::string& fileName);
+        void        close();
+        bool        isOpen() const;
+        bool        isFailed() const;
+        DumpCompression getCompression() const;
+
+        /// read exactly size bytes, false at the end of the stream
+        bool        read(void* data, uint32_t size);
+        /// next line without the line feed, valid until the next call
+        bool        readLine(const char*& line, uint32_t& length);
+        /// look at the first bytes without consuming them
+        uint32_t    peek(void* data, uint32_t size);
+
+    private:
+        /// helpers
+        bool        fill();
+        size_t      readRaw(char* data, size_t size);
+};
+
+#endif // DUMP_READER_H
@@ -0,0 +1,277 @@
+#include "DumpWriter.h"
+#include <cstring>
+
+#ifdef DUMP_GZIP_SUPPORTED
+    #include <zlib.h>
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    #include <zstd.h>
+#endif
+
+
+/**
+    DumpWriter
+*/
+DumpWriter::DumpWriter()
+    : m_file( NULL )
+    , m_compression( DUMP_COMPRESSION_NONE )
+    , m_blockSize( 0 )
+    , m_maxBlocks( 0 )
+    , m_bytesWritten( 0 )
+    , m_failed( false )
+    , m_stop( false )
+    , m_level( -1 )
+{
+}
+DumpWriter::~DumpWriter()
+{
+    close();
+}
+
+/// open/close
+bool DumpWriter::open(const std::string& fileName, DumpCompression compression,
+                      uint32_t threads, uint32_t blockSize, int level, bool text)
+{
+    close();
+
+    compression = resolve(compression);
+    if (!isSupported(compression))
+        return false;
+
+    m_file = fopen(fileName.c_str(), (text && compression == DUMP_COMPRESSION_NONE) ? "wt" : "wb");
+    if (!m_file)
+        return false;
+
+    m_compression = compression;
+    m_blockSize = blockSize ? blockSize : 1;
+    m_bytesWritten = 0;
+    m_failed = false;
+    m_stop = false;
+    m_level = level;
+    if (m_compression == DUMP_COMPRESSION_NONE)
+        return true;
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    m_maxBlocks = threads * 2;
+    for (uint32_t i = 0; i < threads; i++)
+        m_workers.push_back(std::thread(&DumpWriter::workerFunc, this));
+    return true;
+}
+
+bool DumpWriter::close()
+{
+    if (!m_file)
+        return false;
+
+    if (m_compression != DUMP_COMPRESSION_NONE)
+    {
+        submit();
+        flushBlocks(true);
+
+        m_mutex.lock();
+        m_stop = true;
+        m_mutex.unlock();
+        m_cond.notify_all();
+        for (size_t i = 0; i < m_workers.size(); i++)
+            m_workers[i].join();
+        m_workers.clear();
+    }
+
+    if (fclose(m_file) != 0)
+        m_failed = true;
+    m_file = NULL;
+    return !m_failed;
+}
+
+bool DumpWriter::isOpen() const
+{
+    return (m_file != NULL);
+}
+
+/// append data to the stream
+bool DumpWriter::write(const void* data, uint32_t size)
+{
+    if (!m_file || m_failed)
+        return false;
+
+    if (m_compression == DUMP_COMPRESSION_NONE)
+    {
+        if (size && fwrite(data, size, 1, m_file) != 1)
+            m_failed = true;
+        m_bytesWritten += size;
+        return !m_failed;
+    }
+
+    if (!m_current)
+    {
+        m_current = std::make_shared<Block>();
+        m_current->data.reserve(m_blockSize + 512);
+        m_current->ready = false;
+        m_current->failed = false;
+    }
+    m_current->data.append(static_cast<const char*>(data), size);
+    if (m_current->data.size() >= m_blockSize)
+    {
+        submit();
+        return flushBlocks(false);
+    }
+    return true;
+}
+
+/// bytes stored in the file so far
+uint64_t DumpWriter::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+/// compression support
+bool DumpWriter::isSupported(DumpCompression compression)
+{
+    switch (compression)
+    {
+    default: return false;
+    case DUMP_COMPRESSION_NONE: return true;
+#ifdef DUMP_GZIP_SUPPORTED
+    case DUMP_COMPRESSION_GZIP: return true;
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    case DUMP_COMPRESSION_ZSTD: return true;
+#endif
+    case DUMP_COMPRESSION_AUTO: return isSupported(resolve(compression));
+    }
+}
+
+DumpCompression DumpWriter::resolve(DumpCompression compression)
+{
+    if (compression != DUMP_COMPRESSION_AUTO)
+        return compression;
+#if defined(DUMP_ZSTD_SUPPORTED)
+    return DUMP_COMPRESSION_ZSTD;
+#elif defined(DUMP_GZIP_SUPPORTED)
+    return DUMP_COMPRESSION_GZIP;
+#else
+    return DUMP_COMPRESSION_NONE;
+#endif
+}
+
+const char* DumpWriter::getExtension(DumpCompression compression)
+{
+    switch (resolve(compression))
+    {
+    default:
+    case DUMP_COMPRESSION_NONE: return "";
+    case DUMP_COMPRESSION_GZIP: return ".gz";
+    case DUMP_COMPRESSION_ZSTD: return ".zst";
+    }
+}
+
+/// helpers
+void DumpWriter::submit()
+{
+    if (!m_current || m_current->data.empty())
+        return;
+
+    m_mutex.lock();
+    m_blocks.push_back(m_current);
+    m_queue.push_back(m_current);
+    m_mutex.unlock();
+    m_cond.notify_all();
+    m_current.reset();
+}
+
+// write compressed blocks in order: all = wait for every block,
+// otherwise wait only while too many blocks are in flight
+bool DumpWriter::flushBlocks(bool all)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_blocks.empty())
+    {
+        BlockPtr block = m_blocks.front();
+        if (!block->ready)
+        {
+            if (!all && m_blocks.size() <= m_maxBlocks)
+                break;
+            m_cond.wait(lock);
+            continue;
+        }
+        m_blocks.pop_front();
+
+        lock.unlock();
+        if (block->failed || fwrite(block->packed.data(), block->packed.size(), 1, m_file) != 1)
+            m_failed = true;
+        m_bytesWritten += block->packed.size();
+        lock.lock();
+    }
+    return !m_failed;
+}
+
+void DumpWriter::workerFunc()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        while (m_queue.empty() && !m_stop)
+            m_cond.wait(lock);
+        if (m_queue.empty())
+            break;
+
+        BlockPtr block = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        bool result = compress(*block);
+        std::string().swap(block->data);
+        lock.lock();
+
+        block->failed = !result;
+        block->ready = true;
+        m_cond.notify_all();
+    }
+}
+
+bool DumpWriter::compress(Block& block) const
+{
+    switch (m_compression)
+    {
+    default:
+        (void)block;    // no codec built in
+        return false;
+#ifdef DUMP_GZIP_SUPPORTED
+    case DUMP_COMPRESSION_GZIP:
+    {
+        // every block is a complete gzip member
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        int level = (m_level < 0) ? Z_DEFAULT_COMPRESSION : m_level;
+        if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        block.packed.resize(deflateBound(&zs, block.data.size()) + 32);
+        zs.next_in = reinterpret_cast<Bytef*>(&block.data[0]);
+        zs.avail_in = static_cast<uInt>(block.data.size());
+        zs.next_out = reinterpret_cast<Bytef*>(&block.packed[0]);
+        zs.avail_out = static_cast<uInt>(block.packed.size());
+        int errCode = deflate(&zs, Z_FINISH);
+        block.packed.resize(zs.total_out);
+        deflateEnd(&zs);
+        return (errCode == Z_STREAM_END);
+    }
+#endif
+#ifdef DUMP_ZSTD_SUPPORTED
+    case DUMP_COMPRESSION_ZSTD:
+    {
+        // every block is a complete zstd frame
+        int level = (m_level < 0) ? 3 : m_level;
+        block.packed.resize(ZSTD_compressBound(block.data.size()));
+        size_t result = ZSTD_compress(&block.packed[0], block.packed.size(),
+                                      block.data.data(), block.data.size(), level);
+        if (ZSTD_isError(result))
+            return false;
+        block.packed.resize(result);
+        return true;
+    }
+#endif
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef DUMP_WRITER_H
+#define DUMP_WRITER_H
+
+#include "Platform.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+/// the compression libraries are build options: DUMP_GZIP_SUPPORTED links zlib, DUMP_ZSTD_SUPPORTED
+/// links libzstd (make GZIP=1 ZSTD=1, msbuild /p:DumpGzip=true /p:DumpZstd=true)
+
+/**
+    DumpCompression
+    Output format of the dump file
+*/
+enum DumpCompression
+{
+    DUMP_COMPRESSION_NONE = 0,
+    DUMP_COMPRESSION_GZIP,
+    DUMP_COMPRESSION_ZSTD,
+    DUMP_COMPRESSION_AUTO       // zstd if installed, gzip otherwise
+};
+
+/**
+    DumpWriter
+    Sequential dump output. Compressed output is cut into independent blocks,
+    each block is compressed on the worker threads into its own gzip member
+    (zstd frame) and written in order, so the file stays a valid stream for
+    zcat/zstdcat
+*/
+class DumpWriter
+{
+    private:
+        struct Block
+        {
+            std::string     data;
+            std::string     packed;
+            bool            ready;
+            bool            failed;
+        };
+        typedef std::shared_ptr<Block> BlockPtr;
+
+        FILE*                       m_file;
+        DumpCompression             m_compression;
+        uint32_t                    m_blockSize;
+        uint32_t                    m_maxBlocks;    // blocks in flight (memory bound)
+        uint64_t                    m_bytesWritten;
+        bool                        m_failed;
+        BlockPtr                    m_current;
+        std::deque<BlockPtr>        m_blocks;       // in file order
+        std::deque<BlockPtr>        m_queue;        // waiting for a worker
+        std::vector<std::thread>    m_workers;
+        std::mutex                  m_mutex;
+        std::condition_variable     m_cond;
+        bool                        m_stop;
+        int                         m_level;
+
+    public:
+        DumpWriter();
+        ~DumpWriter();
+
+        /// open/close
+        bool        open(const std::string& fileName, DumpCompression compression,
+                         uint32_t threads = 0, uint32_t blockSize = 1 << 20, int level = -1,
+                         bool text = true);
+        bool        close();
+        bool        isOpen() const;
+
+        /// append data to the stream
+        bool        write(const void* data, uint32_t size);
+
+        /// bytes stored in the file so far
+        uint64_t    getBytesWritten() const;
+
+        /// compression support
+        static bool             isSupported(DumpCompression compression);
+        static DumpCompression  resolve(DumpCompression compression);
+        static const char*      getExtension(DumpCompression compression);
+
+    private:
+        /// helpers
+        void        submit();
+        bool        flushBlocks(bool all);
+        void        workerFunc();
+        bool        compress(Block& block) const;
+};
+
+#endif // DUMP_WRITER_H
@@ -0,0 +1,180 @@
+#ifndef INGEST_QUEUE_H
+#define INGEST_QUEUE_H
+
+#include "Platform.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+/**
+    IngestPolicy
+    What the producer does when the queue is full
+*/
+enum IngestPolicy
+{
+    INGEST_BLOCK = 0,       // waits for the writer, nothing is lost
+    INGEST_DROP_OLDEST,     // the oldest queued record is dropped for the new one
+    INGEST_DROP_NEWEST      // the new record is dropped
+};
+
+/**
+    IngestQueue
+    Bounded lock-free ring of fixed-size records: any number of producers, one writer.
+    Each cell has a sequence number telling whose turn it is, so a push is one CAS on
+    the position plus a copy and never waits for the consumer (unless INGEST_BLOCK and full)
+*/
+template <typename T>
+class IngestQueue
+{
+    private:
+        struct Cell
+        {
+            std::atomic<uint64_t>   sequence;
+            T                       record;
+        };
+        /// a position alone on its cache line, the producers and the consumer don't share them:
+        /// padded on both sides since the queue itself is not cache-line aligned (no aligned new before C++17)
+        struct Position
+        {
+            char                    before[64 - sizeof(std::atomic<uint64_t>)];
+            std::atomic<uint64_t>   value;
+            char                    after[64 - sizeof(std::atomic<uint64_t>)];
+        };
+
+        std::unique_ptr<Cell[]>     m_cells;
+        uint64_t                    m_mask;
+        IngestPolicy                m_policy;
+        Position                    m_pushPos;
+        Position                    m_popPos;
+        std::atomic<uint64_t>       m_dropped;
+
+    public:
+        /// the capacity is rounded up to a power of 2
+        IngestQueue(uint32_t capacity, IngestPolicy policy);
+        ~IngestQueue();
+
+        /// false when the record was dropped (INGEST_DROP_NEWEST)
+        bool        push(const T& record);
+        bool        tryPush(const T& record);
+        /// oldest record, NULL just removes it
+        bool        tryPop(T* record);
+
+        bool        empty() const;
+        uint32_t    getCapacity() const;
+        uint64_t    getDropped() const;
+};
+
+template <typename T>
+IngestQueue<T>::IngestQueue(uint32_t capacity, IngestPolicy policy)
+    : m_mask( 0 ),
+      m_policy( policy ),
+      m_dropped( 0 )
+{
+    uint64_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_cells.reset(new Cell[size]);
+    m_mask = size - 1;
+    for (uint64_t i = 0; i < size; i++)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    m_pushPos.value.store(0, std::memory_order_relaxed);
+    m_popPos.value.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+IngestQueue<T>::~IngestQueue()
+{
+}
+
+template <typename T>
+bool IngestQueue<T>::push(const T& record)
+{
+    while (!tryPush(record))
+    {
+        if (m_policy == INGEST_DROP_NEWEST)
+        {
+            m_dropped++;
+            return false;
+        }
+        if (m_policy == INGEST_DROP_OLDEST)
+        {
+            // the producer makes the room itself, the ring takes more than one consumer
+            if (tryPop(NULL))
+                m_dropped++;
+        }
+        else
+            std::this_thread::yield();
+    }
+    return true;
+}
+
+template <typename T>
+bool IngestQueue<T>::tryPush(const T& record)
+{
+    uint64_t pos = m_pushPos.value.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true)
+    {
+        cell = &m_cells[pos & m_mask];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(sequence - pos);
+        if (diff == 0)
+        {
+            if (m_pushPos.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false; // full
+        else
+            pos = m_pushPos.value.load(std::memory_order_relaxed);
+    }
+    cell->record = record;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool IngestQueue<T>::tryPop(T* record)
+{
+    uint64_t pos = m_popPos.value.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true)
+    {
+        cell = &m_cells[pos & m_mask];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(sequence - (pos + 1));
+        if (diff == 0)
+        {
+            if (m_popPos.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false; // empty
+        else
+            pos = m_popPos.value.load(std::memory_order_relaxed);
+    }
+    if (record)
+        *record = cell->record;
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool IngestQueue<T>::empty() const
+{
+    return m_popPos.value.load() == m_pushPos.value.load();
+}
+
+template <typename T>
+uint32_t IngestQueue<T>::getCapacity() const
+{
+    return static_cast<uint32_t>(m_mask + 1);
+}
+
+template <typename T>
+uint64_t IngestQueue<T>::getDropped() const
+{
+    return m_dropped;
+}
+
+#endif // INGEST_QUEUE_H
@@ -0,0 +1,401 @@
+#include "LiveView.h"
+#include "Database.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+/// system specific includes
+#ifdef OS_WINDOWS
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/// segment layout: header, then a block per stream (header and the ring of its seconds)
+static const uint32_t liveViewMagic = 0x5645494C; // "LIVE"
+static const uint32_t liveViewVersion = 2;
+static const uint32_t cacheLine = 64;
+
+// the processes share the atomics of the segment
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "lock-free 32-bit atomics are required");
+
+struct LiveViewHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t streams;
+    uint32_t seconds;
+    uint32_t recordSize;
+    uint32_t writerProcess;         // a segment of a process that is gone can be replaced
+    std::atomic<uint32_t> alive;    // set last by the writer, cleared on close
+};
+
+struct LiveStreamHeader
+{
+    std::atomic<uint32_t> sequence; // odd while the writer changes the stream
+    uint32_t count;                 // seconds in the ring
+    uint32_t head;                  // next position
+    int64_t lastTime;
+};
+
+struct LiveRecord
+{
+    int64_t time;
+    LogSample sample;
+};
+
+/// a copy of the stream blocks is torn if the sequence has changed meanwhile
+static const uint32_t spinsBeforeYield = 64;
+/// a reader gives up on a stream that stays odd (the writer died in publish)
+static const uint32_t maxSpins = 65536;
+
+static uint64_t alignToCacheLine(uint64_t size)
+{
+    return (size + cacheLine - 1) / cacheLine * cacheLine;
+}
+
+static LiveRecord* getRecords(uint8_t* stream)
+{
+    return reinterpret_cast<LiveRecord*>(stream + alignToCacheLine(sizeof(LiveStreamHeader)));
+}
+
+#ifndef OS_WINDOWS
+// an existing segment whose writer process still runs and has not closed it
+static bool isSegmentLive(const std::string& name)
+{
+    int handle = shm_open(name.c_str(), O_RDONLY, 0);
+    if (handle < 0)
+        return false;
+    bool live = false;
+    struct stat st;
+    if (fstat(handle, &st) == 0 && static_cast<uint64_t>(st.st_size) >= sizeof(LiveViewHeader))
+    {
+        void* base = mmap(NULL, sizeof(LiveViewHeader), PROT_READ, MAP_SHARED, handle, 0);
+        if (base != MAP_FAILED)
+        {
+            const LiveViewHeader* header = static_cast<const LiveViewHeader*>(base);
+            // an older layout has no process: taken as live, it is not removed
+            if (header->magic != liveViewMagic || header->version != liveViewVersion)
+                live = true;
+            else if (header->alive.load(std::memory_order_acquire))
+            {
+                pid_t pid = static_cast<pid_t>(header->writerProcess);
+                live = (kill(pid, 0) == 0 || errno == EPERM);
+            }
+            munmap(base, sizeof(LiveViewHeader));
+        }
+    }
+    ::close(handle);
+    return live;
+}
+#endif
+
+
+/**
+    LiveView
+*/
+LiveView::LiveView()
+    : m_base( NULL ),
+      m_size( 0 ),
+#ifdef OS_WINDOWS
+      m_handle( NULL )
+#else
+      m_handle( -1 )
+#endif
+{
+}
+
+LiveView::~LiveView()
+{
+    unmap();
+}
+
+bool LiveView::isOpen() const
+{
+    return m_base != NULL;
+}
+
+uint32_t LiveView::getStreams() const
+{
+    return m_base ? reinterpret_cast<const LiveViewHeader*>(m_base)->streams : 0;
+}
+
+uint32_t LiveView::getSeconds() const
+{
+    return m_base ? reinterpret_cast<const LiveViewHeader*>(m_base)->seconds : 0;
+}
+
+bool LiveView::map(const std::string& name, uint64_t size, bool create)
+{
+    unmap();
+#ifdef OS_WINDOWS
+    if (create)
+    {
+        m_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                      static_cast<DWORD>(size), name.c_str());
+        // the mapping lives as long as a process has it open: it belongs to another writer
+        if (m_handle && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(m_handle);
+            m_handle = NULL;
+        }
+    }
+    else
+        m_handle = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    if (!m_handle)
+        return false;
+    m_base = static_cast<uint8_t*>(MapViewOfFile(m_handle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0,
+                                                 static_cast<SIZE_T>(size)));
+    if (!m_base)
+    {
+        CloseHandle(m_handle);
+        m_handle = NULL;
+        return false;
+    }
+#else
+    if (create)
+    {
+        // the segment of a writer that is gone is replaced (its readers keep it, the new one is a
+        // different object), the one of a running writer is not
+        m_handle = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (m_handle < 0 && errno == EEXIST && !isSegmentLive(name))
+        {
+            shm_unlink(name.c_str());
+            m_handle = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if (m_handle >= 0 && ftruncate(m_handle, static_cast<off_t>(size)) != 0)
+        {
+            ::close(m_handle);
+            shm_unlink(name.c_str());
+            m_handle = -1;
+        }
+    }
+    else
+    {
+        m_handle = shm_open(name.c_str(), O_RDONLY, 0);
+        // a segment shorter than expected would fault on the access
+        struct stat st;
+        if (m_handle >= 0 && (fstat(m_handle, &st) != 0 || static_cast<uint64_t>(st.st_size) < size))
+        {
+            ::close(m_handle);
+            m_handle = -1;
+        }
+    }
+    if (m_handle < 0)
+        return false;
+    void* base = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_handle, 0);
+    if (base == MAP_FAILED)
+    {
+        ::close(m_handle);
+        m_handle = -1;
+        return false;
+    }
+    m_base = static_cast<uint8_t*>(base);
+#endif
+    m_name = name;
+    m_size = size;
+    return true;
+}
+
+void LiveView::unmap()
+{
+    if (!m_base)
+        return;
+#ifdef OS_WINDOWS
+    UnmapViewOfFile(m_base);
+    CloseHandle(m_handle);
+    m_handle = NULL;
+#else
+    munmap(m_base, m_size);
+    ::close(m_handle);
+    m_handle = -1;
+#endif
+    m_base = NULL;
+    m_size = 0;
+}
+
+uint8_t* LiveView::getStream(uint32_t stream) const
+{
+    const LiveViewHeader* header = reinterpret_cast<const LiveViewHeader*>(m_base);
+    if (!m_base || stream >= header->streams)
+        return NULL;
+    return m_base + alignToCacheLine(sizeof(LiveViewHeader)) + stream * getStreamSize(header->seconds);
+}
+
+uint64_t LiveView::getStreamSize(uint32_t seconds)
+{
+    return alignToCacheLine(alignToCacheLine(sizeof(LiveStreamHeader)) + uint64_t(seconds) * sizeof(LiveRecord));
+}
+
+
+/**
+    LiveViewWriter
+*/
+LiveViewWriter::LiveViewWriter()
+{
+}
+
+LiveViewWriter::~LiveViewWriter()
+{
+    close();
+}
+
+bool LiveViewWriter::open(const std::string& name, uint32_t streams, uint32_t seconds)
+{
+    close();
+    if (streams == 0 || seconds == 0)
+        return false;
+    uint64_t size = alignToCacheLine(sizeof(LiveViewHeader)) + streams * getStreamSize(seconds);
+    if (!map(name, size, true))
+        return false;
+
+    // no samples in the streams, sequences even
+    memset(m_base, 0, static_cast<size_t>(m_size));
+    LiveViewHeader* header = reinterpret_cast<LiveViewHeader*>(m_base);
+    header->magic = liveViewMagic;
+    header->version = liveViewVersion;
+    header->streams = streams;
+    header->seconds = seconds;
+    header->recordSize = sizeof(LiveRecord);
+#ifdef OS_WINDOWS
+    header->writerProcess = static_cast<uint32_t>(GetCurrentProcessId());
+#else
+    header->writerProcess = static_cast<uint32_t>(getpid());
+#endif
+    header->alive.store(1, std::memory_order_release);
+    return true;
+}
+
+void LiveViewWriter::close()
+{
+    if (!m_base)
+        return;
+    reinterpret_cast<LiveViewHeader*>(m_base)->alive.store(0, std::memory_order_release);
+    std::string name = m_name;
+    unmap();
+#ifndef OS_WINDOWS
+    shm_unlink(name.c_str());
+#endif
+}
+
+void LiveViewWriter::publish(uint32_t stream, time_t startTime, const LogSample* samples, uint32_t count)
+{
+    uint8_t* block = getStream(stream);
+    if (!block || count == 0)
+        return;
+    LiveStreamHeader* header = reinterpret_cast<LiveStreamHeader*>(block);
+    LiveRecord* records = getRecords(block);
+    uint32_t seconds = getSeconds();
+
+    // only the last seconds of a long batch stay in the ring
+    uint32_t first = (count > seconds) ? count - seconds : 0;
+    if (header->count > 0 && startTime + static_cast<time_t>(count) - 1 <= header->lastTime)
+        return;
+
+    uint32_t sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint32_t i = first; i < count; i++)
+    {
+        int64_t time = startTime + i;
+        if (header->count > 0 && time <= header->lastTime)
+            continue;
+        LiveRecord& record = records[header->head];
+        record.time = time;
+        memcpy(&record.sample, &samples[i], sizeof(LogSample));
+        header->head = (header->head + 1) % seconds;
+        if (header->count < seconds)
+            header->count++;
+        header->lastTime = time;
+    }
+    header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+/**
+    LiveViewReader
+*/
+LiveViewReader::LiveViewReader()
+{
+}
+
+LiveViewReader::~LiveViewReader()
+{
+    close();
+}
+
+bool LiveViewReader::open(const std::string& name)
+{
+    close();
+    // the size comes from the header
+    if (!map(name, sizeof(LiveViewHeader), false))
+        return false;
+    const LiveViewHeader* header = reinterpret_cast<const LiveViewHeader*>(m_base);
+    bool valid = header->alive.load(std::memory_order_acquire) && header->magic == liveViewMagic
+        && header->version == liveViewVersion && header->recordSize == sizeof(LiveRecord);
+    uint32_t streams = header->streams;
+    uint32_t seconds = header->seconds;
+    unmap();
+    if (!valid)
+        return false;
+    return map(name, alignToCacheLine(sizeof(LiveViewHeader)) + streams * getStreamSize(seconds), false);
+}
+
+void LiveViewReader::close()
+{
+    unmap();
+}
+
+bool LiveViewReader::isAlive() const
+{
+    return m_base && reinterpret_cast<const LiveViewHeader*>(m_base)->alive.load(std::memory_order_acquire);
+}
+
+bool LiveViewReader::getLatest(uint32_t stream, LogSample& sample, time_t& time) const
+{
+    return getLast(stream, &sample, &time, 1) == 1;
+}
+
+uint32_t LiveViewReader::getLast(uint32_t stream, LogSample* samples, time_t* times, uint32_t count) const
+{
+    const uint8_t* block = getStream(stream);
+    if (!block || count == 0)
+        return 0;
+    const LiveStreamHeader* header = reinterpret_cast<const LiveStreamHeader*>(block);
+    const LiveRecord* records = getRecords(const_cast<uint8_t*>(block));
+    uint32_t seconds = getSeconds();
+
+    for (uint32_t spins = 1; spins <= maxSpins; spins++)
+    {
+        uint32_t sequence = header->sequence.load(std::memory_order_acquire);
+        uint32_t iResult = 0;
+        if ((sequence & 1) == 0)
+        {
+            uint32_t stored = std::min(header->count, seconds);
+            uint32_t head = header->head % seconds;
+            iResult = std::min(count, stored);
+            for (uint32_t i = 0; i < iResult; i++)
+            {
+                const LiveRecord& record = records[(head + seconds - iResult + i) % seconds];
+                times[i] = static_cast<time_t>(record.time);
+                memcpy(&samples[i], &record.sample, sizeof(LogSample));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->sequence.load(std::memory_order_relaxed) == sequence)
+                return iResult;
+        }
+        if (spins % spinsBeforeYield == 0)
+        {
+            if (!isAlive())
+                return 0;
+            std::this_thread::yield();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef LIVE_VIEW_H
+#define LIVE_VIEW_H
+
+#include "Platform.h"
+#include <string>
+
+struct LogSample;
+
+/**
+    LiveView
+    Shared memory segment with the last seconds of every stream, for the processes
+    that only need the newest values: a seqlock per stream, the writer never waits
+    for the readers and the readers make no system calls (they retry a torn copy).
+    The name is a POSIX shared memory name ("/name") or a Windows mapping name
+*/
+class LiveView
+{
+    protected:
+        std::string m_name;
+        uint8_t*    m_base;     // mapped segment
+        uint64_t    m_size;
+#ifdef OS_WINDOWS
+        void*       m_handle;
+#else
+        int         m_handle;
+#endif
+
+    public:
+        LiveView();
+        virtual ~LiveView();
+
+        bool        isOpen() const;
+        uint32_t    getStreams() const;
+        uint32_t    getSeconds() const;
+
+    protected:
+        /// helpers
+        bool        map(const std::string& name, uint64_t size, bool create);
+        void        unmap();
+        uint8_t*    getStream(uint32_t stream) const;
+        static uint64_t getStreamSize(uint32_t seconds);
+};
+
+/**
+    LiveViewWriter
+    Publishes the samples written to the database, one writer per segment
+*/
+class LiveViewWriter : public LiveView
+{
+    public:
+        LiveViewWriter();
+        ~LiveViewWriter();
+
+        /// creates the segment; false while the process that created one of the same name runs
+        /// (the segment of a writer that is gone is replaced)
+        bool        open(const std::string& name, uint32_t streams, uint32_t seconds);
+        /// the readers still mapping it see it as not alive
+        void        close();
+
+        /// samples of consecutive seconds, the ones not newer than the last published are skipped
+        void        publish(uint32_t stream, time_t startTime, const LogSample* samples, uint32_t count);
+};
+
+/**
+    LiveViewReader
+    Reader library of the segment, needs no database connection
+*/
+class LiveViewReader : public LiveView
+{
+    public:
+        LiveViewReader();
+        ~LiveViewReader();
+
+        /// false while the writer has not created the segment yet
+        bool        open(const std::string& name);
+        void        close();
+        /// false when the writer has closed the segment, open it again to follow a new one
+        bool        isAlive() const;
+
+        /// newest sample of the stream, false when there is none
+        bool        getLatest(uint32_t stream, LogSample& sample, time_t& time) const;
+        /// up to count newest samples, oldest first; returns the number copied, 0 also when the writer
+        /// is gone or keeps the stream busy
+        uint32_t    getLast(uint32_t stream, LogSample* samples, time_t* times, uint32_t count) const;
+};
+
+#endif // LIVE_VIEW_H
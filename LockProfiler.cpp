@@ -0,0 +1,121 @@
+#include "LockProfiler.h"
+#include <chrono>
+
+static const char* siteNames[LOCK_SITES] =
+{
+    "add", "addT", "ingest", "import", "clear", "open", "close", "retention", "compaction", "checkpoint",
+    "backup", "get", "getPcr", "scan", "aggregate", "verifyIntegrity"
+};
+
+
+/**
+    LockProfiler
+*/
+LockProfiler::LockProfiler()
+    : m_enabled( false )
+{
+    reset();
+}
+
+LockProfiler::~LockProfiler()
+{
+}
+
+void LockProfiler::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+}
+
+bool LockProfiler::isEnabled() const
+{
+    return m_enabled.load(std::memory_order_relaxed);
+}
+
+void LockProfiler::record(LockSite site, bool contended, uint64_t waitNs, uint64_t holdNs)
+{
+    Site& s = m_sites[site];
+    s.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (contended)
+        s.contended.fetch_add(1, std::memory_order_relaxed);
+    s.totalWait.fetch_add(waitNs, std::memory_order_relaxed);
+    s.totalHold.fetch_add(holdNs, std::memory_order_relaxed);
+    updateMax(s.maxWait, waitNs);
+    updateMax(s.maxHold, holdNs);
+    s.waitHistogram[getBucket(waitNs)].fetch_add(1, std::memory_order_relaxed);
+    s.holdHistogram[getBucket(holdNs)].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<LockSiteStats> LockProfiler::getStats() const
+{
+    std::vector<LockSiteStats> result;
+    for (uint32_t i = 0; i < LOCK_SITES; i++)
+    {
+        const Site& s = m_sites[i];
+        LockSiteStats stats;
+        stats.acquisitions = s.acquisitions.load(std::memory_order_relaxed);
+        if (stats.acquisitions == 0)
+            continue;
+        stats.site = siteNames[i];
+        stats.contended = s.contended.load(std::memory_order_relaxed);
+        stats.totalWait = s.totalWait.load(std::memory_order_relaxed) * 1e-9;
+        stats.maxWait = s.maxWait.load(std::memory_order_relaxed) * 1e-9;
+        stats.totalHold = s.totalHold.load(std::memory_order_relaxed) * 1e-9;
+        stats.maxHold = s.maxHold.load(std::memory_order_relaxed) * 1e-9;
+        for (uint32_t j = 0; j < lockHistogramBuckets; j++)
+        {
+            stats.waitHistogram[j] = s.waitHistogram[j].load(std::memory_order_relaxed);
+            stats.holdHistogram[j] = s.holdHistogram[j].load(std::memory_order_relaxed);
+        }
+        result.push_back(stats);
+    }
+    return result;
+}
+
+void LockProfiler::reset()
+{
+    for (uint32_t i = 0; i < LOCK_SITES; i++)
+    {
+        Site& s = m_sites[i];
+        s.acquisitions = 0;
+        s.contended = 0;
+        s.totalWait = 0;
+        s.maxWait = 0;
+        s.totalHold = 0;
+        s.maxHold = 0;
+        for (uint32_t j = 0; j < lockHistogramBuckets; j++)
+        {
+            s.waitHistogram[j] = 0;
+            s.holdHistogram[j] = 0;
+        }
+    }
+}
+
+const char* LockProfiler::getSiteName(LockSite site)
+{
+    return (site < LOCK_SITES) ? siteNames[site] : "";
+}
+
+uint64_t LockProfiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t LockProfiler::getBucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    uint32_t bucket = 0;
+    while (us > 0 && bucket < lockHistogramBuckets - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void LockProfiler::updateMax(std::atomic<uint64_t>& value, uint64_t sample)
+{
+    uint64_t current = value.load(std::memory_order_relaxed);
+    while (sample > current && !value.compare_exchange_weak(current, sample, std::memory_order_relaxed))
+        ;
+}
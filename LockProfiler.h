@@ -0,0 +1,97 @@
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include "Platform.h"
+#include <atomic>
+#include <vector>
+
+/**
+    LockSite
+    Callers of the database lock
+*/
+enum LockSite
+{
+    LOCK_SITE_ADD = 0,
+    LOCK_SITE_ADD_T,
+    LOCK_SITE_INGEST,       // writer thread of the queue
+    LOCK_SITE_IMPORT,
+    LOCK_SITE_CLEAR,
+    LOCK_SITE_OPEN,
+    LOCK_SITE_CLOSE,
+    LOCK_SITE_RETENTION,
+    LOCK_SITE_COMPACTION,
+    LOCK_SITE_CHECKPOINT,
+    LOCK_SITE_BACKUP,
+    LOCK_SITE_GET,          // get and the dumps
+    LOCK_SITE_GET_PCR,
+    LOCK_SITE_SCAN,
+    LOCK_SITE_AGGREGATE,
+    LOCK_SITE_VERIFY,
+    LOCK_SITES
+};
+
+/// histogram bucket i counts the times below 2^i microseconds, the last one the rest
+static const uint32_t lockHistogramBuckets = 24;
+
+/**
+    LockSiteStats
+*/
+struct LockSiteStats
+{
+    const char* site;
+    uint64_t    acquisitions;
+    uint64_t    contended;      // the lock was not free
+    double      totalWait;      // seconds
+    double      maxWait;
+    double      totalHold;
+    double      maxHold;
+    uint64_t    waitHistogram[lockHistogramBuckets];
+    uint64_t    holdHistogram[lockHistogramBuckets];
+};
+
+/**
+    LockProfiler
+    Wait and hold times of the lock per call site, the counters are updated without a lock
+*/
+class LockProfiler
+{
+    private:
+        struct Site
+        {
+            std::atomic<uint64_t>   acquisitions;
+            std::atomic<uint64_t>   contended;
+            std::atomic<uint64_t>   totalWait;  // nanoseconds
+            std::atomic<uint64_t>   maxWait;
+            std::atomic<uint64_t>   totalHold;
+            std::atomic<uint64_t>   maxHold;
+            std::atomic<uint64_t>   waitHistogram[lockHistogramBuckets];
+            std::atomic<uint64_t>   holdHistogram[lockHistogramBuckets];
+        };
+
+        Site                m_sites[LOCK_SITES];
+        std::atomic<bool>   m_enabled;
+
+    public:
+        LockProfiler();
+        ~LockProfiler();
+
+        void        setEnabled(bool enabled);
+        bool        isEnabled() const;
+
+        /// one acquisition: its wait and how long the lock was held (nanoseconds)
+        void        record(LockSite site, bool contended, uint64_t waitNs, uint64_t holdNs);
+        /// the sites that took the lock
+        std::vector<LockSiteStats>  getStats() const;
+        void        reset();
+
+        static const char*  getSiteName(LockSite site);
+        /// monotonic time for the measurements
+        static uint64_t     now();
+
+    private:
+        /// helpers
+        static uint32_t     getBucket(uint64_t ns);
+        static void         updateMax(std::atomic<uint64_t>& value, uint64_t sample);
+};
+
+#endif // LOCK_PROFILER_H
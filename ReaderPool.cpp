@@ -0,0 +1,87 @@
+#include "ReaderPool.h"
+
+
+/**
+    ReaderPool
+*/
+ReaderPool::ReaderPool()
+    : m_opened( 0 ),
+      m_isOpen( false )
+{
+}
+
+ReaderPool::~ReaderPool()
+{
+    close();
+}
+
+void ReaderPool::open(const std::string& fileName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fileName = fileName;
+    m_isOpen = true;
+}
+
+void ReaderPool::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_free.size(); i++)
+        sqlite3_close(m_free[i]);
+    m_opened -= static_cast<uint32_t>(m_free.size());
+    m_free.clear();
+    m_isOpen = false;
+}
+
+sqlite3* ReaderPool::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_isOpen)
+        return NULL;
+    if (!m_free.empty())
+    {
+        sqlite3* db = m_free.back();
+        m_free.pop_back();
+        return db;
+    }
+    std::string fileName = m_fileName;
+    m_opened++;
+    lock.unlock();
+
+    // each connection is used by one thread at a time, SQLite needs no mutex for it
+    sqlite3* db = NULL;
+    if (sqlite3_open_v2(fileName.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        lock.lock();
+        m_opened--;
+        return NULL;
+    }
+    return db;
+}
+
+void ReaderPool::release(sqlite3* db)
+{
+    if (!db)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_isOpen)
+    {
+        // the file was closed meanwhile (or will be replaced)
+        sqlite3_close(db);
+        m_opened--;
+        return;
+    }
+    m_free.push_back(db);
+}
+
+uint32_t ReaderPool::getOpened()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_opened;
+}
+
+uint32_t ReaderPool::getActive()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_opened - static_cast<uint32_t>(m_free.size());
+}
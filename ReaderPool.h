@@ -0,0 +1,41 @@
+#ifndef READER_POOL_H
+#define READER_POOL_H
+
+#include "Platform.h"
+#include "sqlite3.h"
+#include <string>
+#include <vector>
+#include <mutex>
+
+/**
+    ReaderPool
+    Read-only connections to the database file, one per concurrent reader, so the
+    readers don't share the writer's connection (and its statements) and run in parallel
+*/
+class ReaderPool
+{
+    private:
+        std::string             m_fileName;
+        std::vector<sqlite3*>   m_free;     // connections not used at the moment
+        uint32_t                m_opened;   // free and used ones
+        bool                    m_isOpen;
+        std::mutex              m_mutex;
+
+    public:
+        ReaderPool();
+        ~ReaderPool();
+
+        void        open(const std::string& fileName);
+        /// closes the free connections, all of them have to be released before
+        void        close();
+
+        /// free connection, a new one is opened when there is none; NULL if closed or failed
+        sqlite3*    acquire();
+        void        release(sqlite3* db);
+
+        uint32_t    getOpened();
+        /// connections acquired and not released yet
+        uint32_t    getActive();
+};
+
+#endif // READER_POOL_H
@@ -0,0 +1,134 @@
+#include "ShardedDatabase.h"
+#include <algorithm>
+
+/// queue of a shard when the options don't set one
+static const uint32_t defaultShardQueueSize = 4096;
+
+
+/**
+    ShardedDatabase
+*/
+ShardedDatabase::ShardedDatabase(const std::string& fileName, const std::vector<uint32_t>& shardChannels,
+                                 bool bRecreate, const DatabaseOptions& options)
+{
+    DatabaseOptions shardOptions = options;
+    if (shardOptions.ingestQueueSize == 0)
+        shardOptions.ingestQueueSize = defaultShardQueueSize;
+    // a dropped sample would leave the shards with different seconds
+    shardOptions.ingestPolicy = INGEST_BLOCK;
+    for (size_t i = 0; i < shardChannels.size(); i++)
+    {
+        shardOptions.channels = shardChannels[i];
+        m_shards.push_back(std::unique_ptr<Database>(new Database(getShardFileName(fileName, i), bRecreate,
+                                                                  shardOptions)));
+        // every shard gets the whole samples, the first one publishes them
+        shardOptions.liveViewName.clear();
+    }
+}
+
+ShardedDatabase::~ShardedDatabase()
+{
+}
+
+std::vector<uint32_t> ShardedDatabase::channelsPerDataSource()
+{
+    std::vector<uint32_t> result;
+    result.push_back(1u << DS_IN_HP1);
+    result.push_back(1u << DS_IN_HP2);
+    result.push_back(1u << DS_OUT_HP);
+#ifdef HIER_MODE_SUPPORTED
+    result.push_back(1u << DS_IN_LP1);
+    result.push_back(1u << DS_IN_LP2);
+    result.push_back(1u << DS_OUT_LP);
+#endif
+    return result;
+}
+
+std::string ShardedDatabase::getShardFileName(const std::string& fileName, uint32_t shard)
+{
+    std::string baseName = fileName;
+    if (baseName.size() > 3 && baseName.compare(baseName.size() - 3, 3, ".db") == 0)
+        baseName.erase(baseName.size() - 3, 3);
+    return baseName + ".shard" + std::to_string(shard) + ".db";
+}
+
+void ShardedDatabase::add(time_t startTime, const LogSample* samples, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        enqueue(startTime + i, samples[i]);
+    flushIngest();
+}
+
+void ShardedDatabase::enqueue(time_t time, const LogSample& sample)
+{
+    for (size_t i = 0; i < m_shards.size(); i++)
+        m_shards[i]->enqueue(time, sample);
+}
+
+void ShardedDatabase::flushIngest()
+{
+    for (size_t i = 0; i < m_shards.size(); i++)
+        m_shards[i]->flushIngest();
+}
+
+// every shard fills its channels of the samples, the shortest run is the result
+uint32_t ShardedDatabase::get(LogSample* samples, uint32_t count, time_t startTime)
+{
+    // the retention of the shards runs separately: start where all of them have data
+    startTime = std::max(startTime, getStartTime());
+    time_t firstTime = 0;
+    for (size_t i = 0; i < m_shards.size() && count > 0; i++)
+    {
+        time_t shardFirstTime = 0;
+        count = std::min(count, m_shards[i]->get(0, samples, count, startTime, &shardFirstTime));
+        if (count == 0)
+            break;
+        // the channels of another shard are from other seconds
+        if (i == 0)
+            firstTime = shardFirstTime;
+        else if (shardFirstTime != firstTime)
+            return 0;
+    }
+    return count;
+}
+
+time_t ShardedDatabase::getStartTime()
+{
+    time_t startTime = 0;
+    for (size_t i = 0; i < m_shards.size(); i++)
+        startTime = std::max(startTime, m_shards[i]->getStartTime());
+    return startTime;
+}
+
+uint32_t ShardedDatabase::getTotalSamples()
+{
+    uint32_t totalSamples = m_shards.empty() ? 0 : m_shards[0]->getTotalSamples();
+    for (size_t i = 1; i < m_shards.size(); i++)
+        totalSamples = std::min(totalSamples, m_shards[i]->getTotalSamples());
+    return totalSamples;
+}
+
+bool ShardedDatabase::verifyIntegrity()
+{
+    bool iResult = true;
+    for (size_t i = 0; i < m_shards.size(); i++)
+        iResult = m_shards[i]->verifyIntegrity() && iResult;
+    return iResult;
+}
+
+void ShardedDatabase::clear()
+{
+    flushIngest();
+    for (size_t i = 0; i < m_shards.size(); i++)
+        m_shards[i]->clear();
+}
+
+uint32_t ShardedDatabase::getShardCount() const
+{
+    return static_cast<uint32_t>(m_shards.size());
+}
+
+Database& ShardedDatabase::getShard(uint32_t shard)
+{
+    return *m_shards[shard];
+}
@@ -0,0 +1,48 @@
+#ifndef SHARDED_DATABASE_H
+#define SHARDED_DATABASE_H
+
+#include "Database.h"
+#include <memory>
+#include <vector>
+
+/**
+    ShardedDatabase
+    One database file per shard, every shard stores a group of the channels
+    (DatabaseOptions::channels) with its own connection and writer thread, so the
+    shards are written in parallel. All the shards get the same seconds, the reads
+    merge them by time
+*/
+class ShardedDatabase
+{
+    private:
+        std::vector<std::unique_ptr<Database>>  m_shards;
+
+    public:
+        /// shardChannels: the channels of every shard (bit per DataSource)
+        ShardedDatabase(const std::string& fileName, const std::vector<uint32_t>& shardChannels, bool bRecreate,
+                        const DatabaseOptions& options = DatabaseOptions());
+        ~ShardedDatabase();
+
+        /// one shard per supported DataSource
+        static std::vector<uint32_t>    channelsPerDataSource();
+        /// "name.db" -> "name.shardN.db"
+        static std::string              getShardFileName(const std::string& fileName, uint32_t shard);
+
+        /// written by all the shards at once, returns when they are done
+        void        add(time_t startTime, const LogSample* samples, uint32_t count);
+        /// queued for the writer threads of the shards
+        void        enqueue(time_t time, const LogSample& sample);
+        void        flushIngest();
+
+        /// the seconds present in all the shards, 0 when the shards don't start at the same second
+        uint32_t    get(LogSample* samples, uint32_t count, time_t startTime);
+        time_t      getStartTime();
+        uint32_t    getTotalSamples();
+        bool        verifyIntegrity();
+        void        clear();
+
+        uint32_t    getShardCount() const;
+        Database&   getShard(uint32_t shard);
+};
+
+#endif // SHARDED_DATABASE_H
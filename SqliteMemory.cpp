@@ -0,0 +1,146 @@
+#include "SqliteMemory.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+/// classes: multiples of 8 up to 128 bytes, then four per power of two up to 64 KB
+/// (at most a quarter of a block unused); larger blocks go to the heap and back
+static const uint32_t smallClasses = 16;
+static const uint32_t maxClasses = smallClasses + 4 * 9;
+static const uint32_t notPooled = 0xFFFFFFFF;
+
+/// in front of every block, 8 bytes keep the alignment of the heap for SQLite
+struct BlockHeader
+{
+    uint32_t sizeClass;     // notPooled = taken from the heap and given back
+    uint32_t size;          // usable bytes
+};
+
+/// a free block, in its own memory
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+static sqlite3_mem_methods heap;        // the methods replaced by install
+static uint32_t classSizes[maxClasses];
+static FreeBlock* freeLists[maxClasses];
+static std::mutex freeListsMutex;
+static bool installed = false;
+
+static uint32_t findClass(uint32_t size)
+{
+    const uint32_t* it = std::lower_bound(classSizes, classSizes + maxClasses, size);
+    return (it == classSizes + maxClasses) ? notPooled : static_cast<uint32_t>(it - classSizes);
+}
+
+static BlockHeader* getHeader(void* p)
+{
+    return static_cast<BlockHeader*>(p) - 1;
+}
+
+
+/**
+    SqliteMemory
+*/
+bool SqliteMemory::install()
+{
+    if (installed)
+        return true;
+    if (sqlite3_config(SQLITE_CONFIG_GETMALLOC, &heap) != SQLITE_OK)
+        return false;
+
+    for (uint32_t i = 0; i < smallClasses; i++)
+        classSizes[i] = (i + 1) * 8;
+    for (uint32_t i = smallClasses, power = 128; i < maxClasses; i += 4, power *= 2)
+    {
+        for (uint32_t k = 0; k < 4; k++)
+            classSizes[i + k] = power + (k + 1) * power / 4;
+    }
+
+    sqlite3_mem_methods methods = { allocate, release, reallocate, size, roundup, init, shutdown, NULL };
+    installed = (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) == SQLITE_OK);
+    return installed;
+}
+
+/// sqlite3_mem_methods
+void* SqliteMemory::allocate(int size)
+{
+    if (size <= 0)
+        return NULL;
+    uint32_t sizeClass = findClass(static_cast<uint32_t>(size));
+    if (sizeClass != notPooled)
+    {
+        std::lock_guard<std::mutex> lock(freeListsMutex);
+        FreeBlock* block = freeLists[sizeClass];
+        if (block)
+        {
+            freeLists[sizeClass] = block->next;
+            return block;
+        }
+    }
+
+    uint32_t usable = (sizeClass != notPooled) ? classSizes[sizeClass] : (static_cast<uint32_t>(size) + 7) & ~7u;
+    BlockHeader* header = static_cast<BlockHeader*>(heap.xMalloc(static_cast<int>(sizeof(BlockHeader) + usable)));
+    if (!header)
+        return NULL;
+    header->sizeClass = sizeClass;
+    header->size = usable;
+    return header + 1;
+}
+
+void SqliteMemory::release(void* p)
+{
+    if (!p)
+        return;
+    BlockHeader* header = getHeader(p);
+    if (header->sizeClass == notPooled)
+    {
+        heap.xFree(header);
+        return;
+    }
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    std::lock_guard<std::mutex> lock(freeListsMutex);
+    block->next = freeLists[header->sizeClass];
+    freeLists[header->sizeClass] = block;
+}
+
+void* SqliteMemory::reallocate(void* p, int size)
+{
+    if (!p)
+        return allocate(size);
+    // the block already has the class of the size
+    uint32_t oldSize = getHeader(p)->size;
+    if (roundup(size) == static_cast<int>(oldSize))
+        return p;
+    void* q = allocate(size);
+    if (!q)
+        return NULL;
+    memcpy(q, p, std::min(oldSize, static_cast<uint32_t>(size)));
+    release(p);
+    return q;
+}
+
+int SqliteMemory::size(void* p)
+{
+    return p ? static_cast<int>(getHeader(p)->size) : 0;
+}
+
+int SqliteMemory::roundup(int size)
+{
+    if (size <= 0)
+        return 8;
+    uint32_t sizeClass = findClass(static_cast<uint32_t>(size));
+    return (sizeClass != notPooled) ? static_cast<int>(classSizes[sizeClass]) : (size + 7) & ~7;
+}
+
+int SqliteMemory::init(void*)
+{
+    return heap.xInit ? heap.xInit(heap.pAppData) : SQLITE_OK;
+}
+
+void SqliteMemory::shutdown(void*)
+{
+    if (heap.xShutdown)
+        heap.xShutdown(heap.pAppData);
+}
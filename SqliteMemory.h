@@ -0,0 +1,33 @@
+#ifndef SQLITE_MEMORY_H
+#define SQLITE_MEMORY_H
+
+#include "Platform.h"
+#include "sqlite3.h"
+
+/**
+    SqliteMemory
+    Memory methods of SQLite (SQLITE_CONFIG_MALLOC) keeping the freed blocks in free lists by
+    size class: once the lists hold the working set of the statements (records, cursors, pages),
+    the writes run without heap allocations. The lookaside memory of a connection does it for
+    the small blocks only, and the SQLite of the distributions is built without it
+    (SQLITE_OMIT_LOOKASIDE). The blocks are not given back to the heap, every class keeps its peak
+*/
+class SqliteMemory
+{
+    public:
+        /// before the first connection is opened, SQLite refuses it once initialized; the blocks
+        /// come from the memory methods installed before. False when refused
+        static bool     install();
+
+    private:
+        /// sqlite3_mem_methods
+        static void*    allocate(int size);
+        static void     release(void* p);
+        static void*    reallocate(void* p, int size);
+        static int      size(void* p);
+        static int      roundup(int size);
+        static int      init(void* param);
+        static void     shutdown(void* param);
+};
+
+#endif // SQLITE_MEMORY_H
@@ -0,0 +1,368 @@
+#include "TaskPool.h"
+
+
+/**
+    PoolTask
+*/
+PoolTask::PoolTask(const std::string& name, TaskPriority priority, const TaskFunc& func)
+    : m_name( name ),
+      m_priority( priority ),
+      m_func( func ),
+      m_cancelled( false ),
+      m_state( POOL_TASK_IDLE ),
+      m_again( false ),
+      m_againDelayMs( 0 ),
+      m_waitTime( 0 ),
+      m_runTime( 0 )
+{
+}
+
+PoolTask::~PoolTask()
+{
+}
+
+const std::string& PoolTask::getName() const
+{
+    return m_name;
+}
+
+TaskPriority PoolTask::getPriority() const
+{
+    return m_priority;
+}
+
+PoolTaskState PoolTask::getState() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_state;
+}
+
+void PoolTask::cancel()
+{
+    m_cancelled = true;
+}
+
+bool PoolTask::isCancelled() const
+{
+    return m_cancelled;
+}
+
+void PoolTask::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_state == POOL_TASK_PENDING || m_state == POOL_TASK_RUNNING)
+        m_cond.wait(lock);
+}
+
+double PoolTask::getWaitTime() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_waitTime;
+}
+
+double PoolTask::getRunTime() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_runTime;
+}
+
+
+/**
+    TaskPool
+*/
+TaskPool::TaskPool(uint32_t threads)
+    : m_ready( 0 ),
+      m_readyBulk( 0 ),
+      m_next( 0 ),
+      m_bulkRunning( 0 ),
+      m_maxBulk( 1 ),
+      m_stop( false )
+{
+    // one thread is always left for the critical tasks, even with a bulk task running
+    if (threads < 2)
+        threads = 2;
+    m_maxBulk = threads - 1;
+    for (uint32_t i = 0; i < threads; i++)
+        m_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    for (uint32_t i = 0; i < threads; i++)
+        m_workers[i]->thread = std::thread(&TaskPool::threadFunc, this, i);
+}
+
+TaskPool::~TaskPool()
+{
+    stop();
+}
+
+std::shared_ptr<PoolTask> TaskPool::createTask(const std::string& name, TaskPriority priority, const TaskFunc& func)
+{
+    return std::make_shared<PoolTask>(name, priority, func);
+}
+
+bool TaskPool::submit(const std::shared_ptr<PoolTask>& task, uint32_t delayMs)
+{
+    std::unique_lock<std::mutex> taskLock(task->m_mutex);
+    if (task->m_cancelled)
+        return false;
+    // merged into the pending run, or one more run after the current one
+    if (task->m_state == POOL_TASK_PENDING)
+        return true;
+    if (task->m_state == POOL_TASK_RUNNING)
+    {
+        task->m_again = true;
+        task->m_againDelayMs = delayMs;
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_stop)
+        return false;
+    task->m_state = POOL_TASK_PENDING;
+    task->m_submitTime = Clock::now();
+    if (delayMs > 0)
+    {
+        m_delayed.insert(std::make_pair(task->m_submitTime + std::chrono::milliseconds(delayMs), task));
+        lock.unlock();
+        m_cond.notify_one();
+        return true;
+    }
+    lock.unlock();
+    taskLock.unlock();
+    enqueue(task);
+    return true;
+}
+
+std::shared_ptr<PoolTask> TaskPool::submit(const std::string& name, TaskPriority priority, const TaskFunc& func,
+                                           uint32_t delayMs)
+{
+    std::shared_ptr<PoolTask> task = createTask(name, priority, func);
+    if (!submit(task, delayMs))
+        task->cancel();
+    return task;
+}
+
+void TaskPool::stop()
+{
+    std::multimap<Clock::time_point, std::shared_ptr<PoolTask>> delayed;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        delayed.swap(m_delayed);
+    }
+    m_cond.notify_all();
+    for (std::multimap<Clock::time_point, std::shared_ptr<PoolTask>>::iterator it = delayed.begin();
+         it != delayed.end(); ++it)
+    {
+        std::lock_guard<std::mutex> lock(it->second->m_mutex);
+        it->second->m_state = POOL_TASK_IDLE;
+        it->second->m_cond.notify_all();
+    }
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        if (m_workers[i]->thread.joinable())
+            m_workers[i]->thread.join();
+    }
+}
+
+std::vector<TaskStats> TaskPool::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    std::vector<TaskStats> result;
+    for (std::map<std::string, TaskStats>::const_iterator it = m_stats.begin(); it != m_stats.end(); ++it)
+        result.push_back(it->second);
+    return result;
+}
+
+uint32_t TaskPool::getThreads() const
+{
+    return static_cast<uint32_t>(m_workers.size());
+}
+
+void TaskPool::threadFunc(uint32_t index)
+{
+    std::vector<std::shared_ptr<PoolTask>> due;
+    while (true)
+    {
+        std::shared_ptr<PoolTask> task = takeTask(index);
+        if (task)
+        {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Clock::time_point now = Clock::now();
+        while (!m_delayed.empty() && m_delayed.begin()->first <= now)
+        {
+            due.push_back(m_delayed.begin()->second);
+            m_delayed.erase(m_delayed.begin());
+        }
+        if (!due.empty())
+        {
+            lock.unlock();
+            for (size_t i = 0; i < due.size(); i++)
+                enqueue(due[i]);
+            due.clear();
+            continue;
+        }
+        // the ready tasks are finished before the stop
+        if (m_ready > 0 || (m_readyBulk > 0 && m_bulkRunning < m_maxBulk))
+            continue;
+        if (m_stop)
+            break;
+        if (m_delayed.empty())
+            m_cond.wait(lock);
+        else
+            m_cond.wait_until(lock, m_delayed.begin()->first);
+    }
+}
+
+void TaskPool::enqueue(const std::shared_ptr<PoolTask>& task)
+{
+    Worker& worker = *m_workers[m_next++ % m_workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queues[task->m_priority].tasks.push_back(task);
+    }
+    if (task->m_priority == TASK_BULK)
+        m_readyBulk++;
+    else
+        m_ready++;
+    wakeUp();
+}
+
+// the highest priority first: own queue, then the others
+std::shared_ptr<PoolTask> TaskPool::takeTask(uint32_t index)
+{
+    uint32_t threads = static_cast<uint32_t>(m_workers.size());
+    for (uint32_t p = 0; p < TASK_PRIORITIES; p++)
+    {
+        TaskPriority priority = static_cast<TaskPriority>(p);
+        if (priority == TASK_BULK)
+        {
+            // reserve the slot before taking the task
+            uint32_t running = m_bulkRunning;
+            do
+            {
+                if (running >= m_maxBulk)
+                    return std::shared_ptr<PoolTask>();
+            } while (!m_bulkRunning.compare_exchange_weak(running, running + 1));
+        }
+
+        std::shared_ptr<PoolTask> task = takeFrom(*m_workers[index], priority, true);
+        for (uint32_t i = 1; !task && i < threads; i++)
+            task = takeFrom(*m_workers[(index + i) % threads], priority, false);
+        if (task)
+        {
+            if (priority == TASK_BULK)
+                m_readyBulk--;
+            else
+                m_ready--;
+            return task;
+        }
+        if (priority == TASK_BULK)
+            m_bulkRunning--;
+    }
+    return std::shared_ptr<PoolTask>();
+}
+
+// the owner takes the newest task of its queue, the thieves the oldest one:
+// they work on the opposite ends and a task left behind by the owner is stolen first
+std::shared_ptr<PoolTask> TaskPool::takeFrom(Worker& worker, TaskPriority priority, bool own)
+{
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    TaskQueue& queue = worker.queues[priority];
+    if (queue.head == queue.tasks.size())
+        return std::shared_ptr<PoolTask>();
+    std::shared_ptr<PoolTask> task;
+    if (own)
+    {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+    }
+    else
+        task = std::move(queue.tasks[queue.head++]);
+
+    // the taken slots are reused once the queue is empty, or moved out when they are the most
+    if (queue.head == queue.tasks.size())
+    {
+        queue.tasks.clear();
+        queue.head = 0;
+    }
+    else if (queue.head * 2 > queue.tasks.size())
+    {
+        queue.tasks.erase(queue.tasks.begin(), queue.tasks.begin() + queue.head);
+        queue.head = 0;
+    }
+    return task;
+}
+
+void TaskPool::run(const std::shared_ptr<PoolTask>& task)
+{
+    bool bulk = (task->m_priority == TASK_BULK);
+    Clock::time_point startTime = Clock::now();
+    bool cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(task->m_mutex);
+        cancelled = task->m_cancelled;
+        if (cancelled)
+        {
+            task->m_state = POOL_TASK_CANCELLED;
+            task->m_cond.notify_all();
+        }
+        else
+        {
+            task->m_state = POOL_TASK_RUNNING;
+            task->m_waitTime = std::chrono::duration<double>(startTime - task->m_submitTime).count();
+        }
+    }
+    if (!cancelled)
+        task->m_func(*task);
+    if (bulk)
+    {
+        m_bulkRunning--;
+        wakeUp();
+    }
+
+    bool again = false;
+    uint32_t againDelayMs = 0;
+    if (!cancelled)
+    {
+        std::lock_guard<std::mutex> lock(task->m_mutex);
+        task->m_runTime = std::chrono::duration<double>(Clock::now() - startTime).count();
+        again = task->m_again && !task->m_cancelled;
+        againDelayMs = task->m_againDelayMs;
+        task->m_again = false;
+        task->m_state = task->m_cancelled ? POOL_TASK_CANCELLED : POOL_TASK_IDLE;
+        task->m_cond.notify_all();
+    }
+    addStats(*task, cancelled);
+    if (again)
+        submit(task, againDelayMs);
+}
+
+void TaskPool::addStats(const PoolTask& task, bool cancelled)
+{
+    std::lock_guard<std::mutex> taskLock(task.m_mutex);
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    TaskStats& stats = m_stats[task.m_name];
+    stats.name = task.m_name;
+    if (cancelled)
+    {
+        stats.cancelled++;
+        return;
+    }
+    stats.runs++;
+    stats.totalWait += task.m_waitTime;
+    stats.maxWait = std::max(stats.maxWait, task.m_waitTime);
+    stats.totalRun += task.m_runTime;
+    stats.maxRun = std::max(stats.maxRun, task.m_runTime);
+}
+
+// a sleeping thread takes the new task (or looks at the timers again)
+void TaskPool::wakeUp()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_cond.notify_one();
+}
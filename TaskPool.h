@@ -0,0 +1,169 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include "Platform.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class PoolTask;
+
+typedef std::function<void(PoolTask& task)> TaskFunc;
+
+/**
+    TaskPriority
+    A ready task of a higher priority is always taken first
+*/
+enum TaskPriority
+{
+    TASK_CRITICAL = 0,  // keeps the ingest going (retention)
+    TASK_NORMAL,        // housekeeping (compaction, file deletion)
+    TASK_BULK,          // long jobs (dumps), never on all the threads at once
+    TASK_PRIORITIES
+};
+
+/**
+    PoolTaskState
+*/
+enum PoolTaskState
+{
+    POOL_TASK_IDLE = 0,     // created, or done and can be submitted again
+    POOL_TASK_PENDING,
+    POOL_TASK_RUNNING,
+    POOL_TASK_CANCELLED
+};
+
+/**
+    PoolTask
+    Maintenance task of the TaskPool. It can be submitted again: a submit while it waits
+    is merged into that run, a submit while it runs makes one more run. Cancellation is
+    cooperative: a pending task is dropped, a running one checks isCancelled()
+*/
+class PoolTask
+{
+    friend class TaskPool;
+
+    private:
+        typedef std::chrono::steady_clock   Clock;
+
+        std::string                 m_name;
+        TaskPriority                m_priority;
+        TaskFunc                    m_func;
+        std::atomic<bool>           m_cancelled;
+        PoolTaskState               m_state;
+        bool                        m_again;        // submitted while pending or running
+        uint32_t                    m_againDelayMs;
+        Clock::time_point           m_submitTime;
+        double                      m_waitTime;     // last run: seconds in the queue
+        double                      m_runTime;      // last run: seconds running
+        mutable std::mutex          m_mutex;
+        std::condition_variable     m_cond;
+
+    public:
+        PoolTask(const std::string& name, TaskPriority priority, const TaskFunc& func);
+        ~PoolTask();
+
+        const std::string&  getName() const;
+        TaskPriority        getPriority() const;
+        PoolTaskState       getState() const;
+
+        void                cancel();
+        bool                isCancelled() const;
+
+        /// waits until the task is neither pending nor running
+        void                wait();
+
+        /// timing of the last run
+        double              getWaitTime() const;
+        double              getRunTime() const;
+};
+
+/**
+    TaskStats
+    Timing of all runs of the tasks with the same name
+*/
+struct TaskStats
+{
+    std::string name;
+    uint64_t    runs = 0;
+    uint64_t    cancelled = 0;
+    double      totalWait = 0;  // seconds
+    double      maxWait = 0;
+    double      totalRun = 0;
+    double      maxRun = 0;
+};
+
+/**
+    TaskPool
+    Small work-stealing pool for the maintenance of the database: every thread has
+    its own queues (one per priority), the submits are spread over them and an idle
+    thread steals from the others. Delayed tasks wait in a timer list
+*/
+class TaskPool
+{
+    private:
+        typedef std::chrono::steady_clock   Clock;
+
+        /// the taken tasks are left in front of head: the queue keeps its memory, a task
+        /// submitted with every write allocates nothing once the queue has held its peak
+        struct TaskQueue
+        {
+            std::vector<std::shared_ptr<PoolTask>>  tasks;
+            size_t                                  head = 0;
+        };
+
+        struct Worker
+        {
+            std::mutex                              mutex;
+            TaskQueue                               queues[TASK_PRIORITIES];
+            std::thread                             thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>>    m_workers;
+        std::multimap<Clock::time_point, std::shared_ptr<PoolTask>> m_delayed;
+        std::mutex                              m_mutex;    // sleeping threads, m_delayed
+        std::condition_variable                 m_cond;
+        std::atomic<int32_t>                    m_ready;    // tasks in the queues (may go below 0 for a moment)
+        std::atomic<int32_t>                    m_readyBulk;
+        std::atomic<uint32_t>                   m_next;     // queue of the next submit
+        std::atomic<uint32_t>                   m_bulkRunning;
+        uint32_t                                m_maxBulk;
+        bool                                    m_stop;
+        std::map<std::string, TaskStats>        m_stats;
+        mutable std::mutex                      m_statsMutex;
+
+    public:
+        /// at least 2 threads: one of them is kept from the bulk tasks
+        explicit TaskPool(uint32_t threads);
+        ~TaskPool();
+
+        static std::shared_ptr<PoolTask>    createTask(const std::string& name, TaskPriority priority,
+                                                       const TaskFunc& func);
+        /// false when the task is cancelled or the pool is stopped
+        bool                                submit(const std::shared_ptr<PoolTask>& task, uint32_t delayMs = 0);
+        std::shared_ptr<PoolTask>           submit(const std::string& name, TaskPriority priority,
+                                                   const TaskFunc& func, uint32_t delayMs = 0);
+
+        /// the ready tasks are run, the delayed ones dropped
+        void                                stop();
+
+        std::vector<TaskStats>              getStats() const;
+        uint32_t                            getThreads() const;
+
+    private:
+        void                                threadFunc(uint32_t index);
+        void                                enqueue(const std::shared_ptr<PoolTask>& task);
+        std::shared_ptr<PoolTask>           takeTask(uint32_t index);
+        std::shared_ptr<PoolTask>           takeFrom(Worker& worker, TaskPriority priority, bool own);
+        void                                run(const std::shared_ptr<PoolTask>& task);
+        void                                addStats(const PoolTask& task, bool cancelled);
+        void                                wakeUp();
+};
+
+#endif // TASK_POOL_H
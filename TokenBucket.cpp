@@ -0,0 +1,57 @@
+#include "TokenBucket.h"
+
+
+/**
+    TokenBucket
+*/
+TokenBucket::TokenBucket(double rate, double capacity)
+    : m_rate( 0 )
+    , m_capacity( 0 )
+    , m_tokens( 0 )
+{
+    setRate(rate, capacity);
+}
+TokenBucket::~TokenBucket()
+{
+}
+
+/// configuration
+void TokenBucket::setRate(double rate, double capacity)
+{
+    m_rate = (rate > 0) ? rate : 0;
+    // default burst is one second of the budget
+    m_capacity = (capacity > 0) ? capacity : m_rate;
+    m_tokens = m_capacity;
+    m_timer.start();
+}
+
+bool TokenBucket::isLimited() const
+{
+    return (m_rate > 0);
+}
+
+/// take tokens
+double TokenBucket::consume(double tokens)
+{
+    if (!isLimited())
+        return 0.0;
+
+    refill();
+    m_tokens -= tokens;
+    if (m_tokens >= 0)
+        return 0.0;
+
+    // pay the debt back before returning
+    double waitTime = -m_tokens / m_rate;
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(waitTime * 1e6)));
+    refill();
+    return waitTime;
+}
+
+/// helpers
+void TokenBucket::refill()
+{
+    m_tokens += m_timer.getElapsed() * m_rate;
+    if (m_tokens > m_capacity)
+        m_tokens = m_capacity;
+}
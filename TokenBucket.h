@@ -0,0 +1,36 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include "Platform.h"
+#include "Timer.h"
+
+/**
+    TokenBucket
+    Rate limiter: tokens are refilled at the fixed rate up to the capacity,
+    consumers wait while the bucket is in debt
+*/
+class TokenBucket
+{
+    private:
+        double  m_rate;         // tokens per second, 0 = unlimited
+        double  m_capacity;     // burst size
+        double  m_tokens;       // available tokens (negative = debt)
+        Timer   m_timer;
+
+    public:
+        explicit TokenBucket(double rate = 0, double capacity = 0);
+        ~TokenBucket();
+
+        /// configuration
+        void    setRate(double rate, double capacity = 0);
+        bool    isLimited() const;
+
+        /// take tokens, blocks until the budget allows it; returns the waiting time (seconds)
+        double  consume(double tokens);
+
+    private:
+        /// helpers
+        void    refill();
+};
+
+#endif // TOKEN_BUCKET_H
@@ -1,7 +1,82 @@
 #include "Database.h"
 #include "Timer.h"
+#include "Codec.h"
+#include "ShardedDatabase.h"
+#include "SqliteMemory.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #define DEBUG
 //#include <windows.h> 
+//#define COUNT_ALLOCATIONS
+
+#ifdef COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// counting allocator: every C++ heap allocation of the process is counted, and the ones of
+// SQLite through its memory methods (countSqliteAllocations before the first database is opened);
+// under SqliteMemory these are the blocks its free lists take from the heap
+static std::atomic<uint64_t> g_allocations(0);
+static sqlite3_mem_methods g_sqliteMemory;
+
+void* operator new(size_t size)
+{
+	g_allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	g_allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static void* countingMalloc(int size)
+{
+	g_allocations++;
+	return g_sqliteMemory.xMalloc(size);
+}
+
+static void* countingRealloc(void* p, int size)
+{
+	g_allocations++;
+	return g_sqliteMemory.xRealloc(p, size);
+}
+#endif
+
+void countSqliteAllocations()
+{
+#ifdef COUNT_ALLOCATIONS
+	sqlite3_config(SQLITE_CONFIG_GETMALLOC, &g_sqliteMemory);
+	sqlite3_mem_methods counting = g_sqliteMemory;
+	counting.xMalloc = countingMalloc;
+	counting.xRealloc = countingRealloc;
+	sqlite3_config(SQLITE_CONFIG_MALLOC, &counting);
+#endif
+}
+
+uint64_t getAllocations()
+{
+#ifdef COUNT_ALLOCATIONS
+	return g_allocations;
+#else
+	return 0;
+#endif
+}
 
 
 
@@ -64,24 +139,35 @@ time_t fillRandomToInputOutput(Database& db, uint32_t size, time_t startTime = t
 	return startTime;
 }
 
-void dumpThreadFunc(Database& database)
+void dumpDone(DumpJob& job, bool result, void* /*param*/)
+{
+	if (result)
+		std::cout << "DUMP HAS BEEN DONE\n";
+	else if (job.getState() == DUMP_JOB_CANCELLED)
+		std::cout << "DUMP HAS BEEN CANCELLED\n";
+	else
+		std::cout << "DUMP HAS BEEN FAILED\n";
+	std::cout << job.getElapsed() << "\n";
+}
+
+std::shared_ptr<DumpJob> startDumpJob(Database& database, DumpCompression compression)
 {
 	std::stringstream ss;
 	char timeStr[32];
 	time_t local = time(NULL);
 	strftime(timeStr, sizeof(timeStr), "%F_%H-%M-%S", localtime(&local));
 	std::string str(timeStr);
-	ss << "dump_" << str << ".csv";
-	Timer timer;
+	ss << "dump_" << str << ".csv" << DumpWriter::getExtension(compression);
+	DumpOptions options;
+	options.compression = compression;
 	std::cout << "DUMP HAS BEEN STARTED\n";
-	timer.start();
-	bool result = database.dump(ss.str());	
-	double timeStamp = timer.stop();
-	if (result)
-		std::cout << "DUMP HAS BEEN DONE\n";
-	else
-		std::cout << "DUMP HAS BEEN FAILED\n";
-	std::cout << timeStamp << "\n";
+	return database.startDump(ss.str(), options, dumpDone, NULL);
+}
+
+void printDumpProgress(const DumpJob& job)
+{
+	std::cout << "DUMP " << job.getRowsDone() << "/" << job.getRowsTotal() << " ROWS, "
+		<< job.getBytesWritten() << " BYTES, ETA " << job.getEta() << "\n";
 }
 
 uint32_t tableEntry(char* buffer, uint32_t bufferSize, double time)
@@ -167,13 +253,738 @@ void addTesting(Database& database, uint32_t size, uint32_t begin, uint32_t end,
 	fs << "\n";
 }
 
+void backupProgress(uint32_t remaining, uint32_t total, void* /*param*/)
+{
+	std::cout << "BACKUP " << (total - remaining) << "/" << total << " PAGES\n";
+}
+
+struct LatencyStats
+{
+	double avg = 0;
+	double p99 = 0;
+	double max = 0;
+};
+
+// write count samples one by one (with the interval between them) and collect the write latency
+LatencyStats ingestLatency(Database& database, time_t& nextTime, uint32_t count, uint32_t intervalMs = 0)
+{
+	Timer timer;
+	std::vector<double> latencies;
+	LatencyStats stats;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		timer.start();
+		fillRandomToInputOutput(database, 1, nextTime++);
+		double timeStamp = timer.stop();
+		latencies.push_back(timeStamp);
+		stats.avg += timeStamp;
+		if (intervalMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+	}
+	if (latencies.empty())
+		return stats;
+	std::sort(latencies.begin(), latencies.end());
+	stats.avg /= latencies.size();
+	stats.p99 = latencies[(latencies.size() - 1) * 99 / 100];
+	stats.max = latencies.back();
+	return stats;
+}
+
+void backupTesting(Database& database, std::ofstream& fs)
+{
+	const uint32_t count = 200;
+	time_t nextTime = database.getStartTime() + database.getTotalSamples();
+	LatencyStats idle = ingestLatency(database, nextTime, count);
+
+	bool result = false;
+	std::thread backupThread([&database, &result]()
+	{
+		result = database.backup("dbBackup.db", 16, 10, backupProgress, NULL);
+	});
+	LatencyStats busy = ingestLatency(database, nextTime, count);
+	backupThread.join();
+
+	fs << "ingest avg, ingest max, ingest avg (backup), ingest max (backup)\n";
+	fs << idle.avg << ", " << idle.max << ", " << busy.avg << ", " << busy.max << "\n";
+	std::cout << "INGEST WITHOUT BACKUP " << idle.avg << " (max " << idle.max << ")\n";
+	std::cout << "INGEST WITH BACKUP " << busy.avg << " (max " << busy.max << ")"
+		<< (result ? "" : " BACKUP HAS BEEN FAILED") << "\n";
+}
+
+// ingest p99 alone, with a full-speed dump and with a throttled dump running at the same time
+void dumpTesting(Database& database, std::ofstream& fs)
+{
+	const uint32_t count = 300;
+	const uint32_t intervalMs = 10;
+	time_t nextTime = database.getStartTime() + database.getTotalSamples();
+
+	DumpOptions fullSpeed;
+	DumpOptions throttled;
+	throttled.rowsPerSec = 20000;
+	throttled.bytesPerSec = 4e6;
+	throttled.maxPendingWriters = 1;
+	throttled.maxWriterLatency = 0.01;
+	DumpOptions modes[] = { fullSpeed, throttled };
+	const char* names[] = { "full speed", "throttled" };
+
+	LatencyStats idle = ingestLatency(database, nextTime, count, intervalMs);
+	fs << "mode, ingest avg, ingest p99, ingest max, dump time\n";
+	fs << "no dump, " << idle.avg << ", " << idle.p99 << ", " << idle.max << ", 0\n";
+	std::cout << "INGEST P99 WITHOUT DUMP " << idle.p99 << "\n";
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		std::shared_ptr<DumpJob> job = database.startDump("dumpTesting.csv", modes[i]);
+		LatencyStats busy = ingestLatency(database, nextTime, count, intervalMs);
+		job->wait();
+		double dumpTime = job->getElapsed();
+
+		fs << names[i] << ", " << busy.avg << ", " << busy.p99 << ", " << busy.max << ", " << dumpTime << "\n";
+		std::cout << "INGEST P99 WITH " << names[i] << " DUMP " << busy.p99 << " (dump " << dumpTime << ")\n";
+	}
+}
+
+// restore speed of both dump formats into an empty database
+void importTesting(Database& database, std::ofstream& fs)
+{
+	DumpFormat formats[] = { DUMP_FORMAT_CSV, DUMP_FORMAT_BINARY };
+	const char* names[] = { "importTesting.csv", "importTesting.bin" };
+	uint32_t total = database.getTotalSamples();
+
+	fs << "format, dump time, import time, rows per second\n";
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		DumpOptions options;
+		options.format = formats[i];
+		Timer timer(true);
+		database.dump(names[i], options);
+		double dumpTime = timer.stop();
+
+		Database restored("dbImport.db", true);
+		timer.start();
+		bool result = restored.import(names[i]);
+		double importTime = timer.stop();
+
+		fs << names[i] << ", " << dumpTime << ", " << importTime << ", " << total / importTime << "\n";
+		std::cout << "IMPORT " << names[i] << (result ? " " : " FAILED ") << restored.getTotalSamples()
+			<< " ROWS IN " << importTime << "\n";
+	}
+}
+
+// XOR float codec on the stored DF and PCR values: size and decode speed against the SQLite read
+void codecTesting(Database& database, std::ofstream& fs)
+{
+	uint32_t size = database.getTotalSamples();
+	std::vector<LogSample> samples(size);
+	time_t startTime = database.getStartTime();
+	Timer timer(true);
+	size = database.get(&samples[0], size, startTime);
+	double getTime = timer.stop();
+
+	std::vector<float> delayFactor;
+	std::vector<float> pcr;
+	std::vector<uint32_t> rate;
+	std::vector<uint32_t> mediaLossRate;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		const InputData* inputs[] = { &samples[i].hp1, &samples[i].hp2 };
+		for (uint32_t j = 0; j < 2; j++)
+		{
+			delayFactor.push_back(inputs[j]->delayFactor);
+			mediaLossRate.push_back(inputs[j]->mediaLossRate);
+			pcr.insert(pcr.end(), inputs[j]->pcrArray, inputs[j]->pcrArray + inputs[j]->samples);
+		}
+		// one channel per column, the way the blocks keep them
+		rate.push_back(samples[i].hp1.rate);
+		delayFactor.push_back(samples[i].hpOut.delayFactor);
+		pcr.insert(pcr.end(), samples[i].hpOut.pcrArray, samples[i].hpOut.pcrArray + samples[i].hpOut.samples);
+	}
+
+	std::vector<float>* columns[] = { &delayFactor, &pcr };
+	const char* names[] = { "delayFactor", "pcrArray" };
+	fs << "column, values, raw bytes, encoded bytes, encode time, decode time, sqlite get time\n";
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		std::vector<float>& column = *columns[i];
+		std::vector<uint8_t> encoded;
+		std::vector<float> decoded(column.size());
+		if (column.empty())
+			continue;
+
+		timer.start();
+		Codec::encodeFloats(&column[0], column.size(), encoded);
+		double encodeTime = timer.stop();
+		timer.start();
+		bool result = Codec::decodeFloats(&encoded[0], encoded.size(), &decoded[0], decoded.size());
+		double decodeTime = timer.stop();
+		result = result && (memcmp(&column[0], &decoded[0], column.size() * sizeof(float)) == 0);
+
+		fs << names[i] << ", " << column.size() << ", " << column.size() * sizeof(float) << ", "
+			<< encoded.size() << ", " << encodeTime << ", " << decodeTime << ", " << getTime << "\n";
+		std::cout << names[i] << ": " << column.size() * sizeof(float) << " -> " << encoded.size()
+			<< " BYTES, DECODE " << decodeTime << " (GET " << getTime << ")" << (result ? "" : " MISMATCH") << "\n";
+	}
+
+	// PCR values with half precision (PCR_FLOAT16)
+	if (!pcr.empty())
+	{
+		std::vector<uint8_t> encoded;
+		std::vector<float> decoded(pcr.size());
+		Codec::encodeHalfs(&pcr[0], pcr.size(), encoded);
+		timer.start();
+		Codec::decodeHalfs(&encoded[0], encoded.size(), &decoded[0], decoded.size());
+		double decodeTime = timer.stop();
+		float maxError = 0;
+		for (size_t i = 0; i < pcr.size(); i++)
+			maxError = std::max(maxError, std::fabs(pcr[i] - decoded[i]));
+
+		fs << "pcrArray (half), " << pcr.size() << ", " << pcr.size() * sizeof(float) << ", "
+			<< encoded.size() << ", , " << decodeTime << ", " << getTime << "\n";
+		std::cout << "pcrArray (half): " << pcr.size() * sizeof(float) << " -> " << encoded.size()
+			<< " BYTES, DECODE " << decodeTime << ", MAX ERROR " << maxError << "\n";
+	}
+
+	// integer columns: rate as deltas, mediaLossRate as it is and with losses in 1% of seconds only
+	std::vector<uint32_t> healthyLossRate(mediaLossRate.size(), 0);
+	for (size_t i = 0; i < healthyLossRate.size(); i += 100)
+		healthyLossRate[i] = mediaLossRate[i] + 1;
+
+	std::vector<uint32_t>* intColumns[] = { &rate, &mediaLossRate, &healthyLossRate };
+	const char* intNames[] = { "rate", "mediaLossRate", "mediaLossRate (1%)" };
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		std::vector<uint32_t>& column = *intColumns[i];
+		std::vector<uint8_t> encoded;
+		std::vector<uint32_t> decoded(column.size());
+		if (column.empty())
+			continue;
+
+		timer.start();
+		if (i == 0)
+			Codec::encodeDeltas(&column[0], column.size(), encoded);
+		else
+			Codec::encodeSparse(&column[0], column.size(), encoded);
+		double encodeTime = timer.stop();
+		timer.start();
+		bool result = (i == 0) ? Codec::decodeDeltas(&encoded[0], encoded.size(), &decoded[0], decoded.size()) :
+								 Codec::decodeSparse(&encoded[0], encoded.size(), &decoded[0], decoded.size());
+		double decodeTime = timer.stop();
+		result = result && (column == decoded);
+
+		fs << intNames[i] << ", " << column.size() << ", " << column.size() * sizeof(uint32_t) << ", "
+			<< encoded.size() << ", " << encodeTime << ", " << decodeTime << ", " << getTime << "\n";
+		std::cout << intNames[i] << ": " << column.size() * sizeof(uint32_t) << " -> " << encoded.size()
+			<< " BYTES, DECODE " << decodeTime << (result ? "" : " MISMATCH") << "\n";
+	}
+
+	// get returns contiguous seconds
+	std::vector<int64_t> times(size);
+	for (uint32_t i = 0; i < size; i++)
+		times[i] = startTime + i;
+	std::vector<uint8_t> encoded;
+	Codec::encodeTimes(times.empty() ? NULL : &times[0], size, encoded);
+	fs << "time, " << size << ", " << size * sizeof(int64_t) << ", " << encoded.size() << "\n";
+	std::cout << "time: " << size * sizeof(int64_t) << " -> " << encoded.size() << " BYTES\n";
+}
+
+// the same data in the row and in the chunked storage: ingest, full read and file size
+void storageTesting(uint32_t size, std::ofstream& fs)
+{
+	StorageMode modes[] = { STORAGE_ROWS, STORAGE_CHUNKED };
+	const char* names[] = { "dbRows.db", "dbChunked.db" };
+	time_t startTime = time(NULL);
+	std::vector<LogSample> samples(size);
+
+	fs << "storage, add time, get time, file size\n";
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		DatabaseOptions options;
+		options.storage = modes[i];
+		Timer timer;
+		double addTime = 0;
+		double getTime = 0;
+		{
+			Database database(names[i], true, options);
+			timer.start();
+			fillRandomToInputOutput(database, size, startTime);
+			addTime = timer.stop();
+
+			timer.start();
+			database.get(&samples[0], size, database.getStartTime());
+			getTime = timer.stop();
+		}
+		struct stat st;
+		long fileSize = (stat(names[i], &st) == 0) ? st.st_size : 0;
+
+		fs << names[i] << ", " << addTime << ", " << getTime << ", " << fileSize << "\n";
+		std::cout << names[i] << ": ADD " << addTime << ", GET " << getTime << ", " << fileSize << " BYTES\n";
+	}
+}
+
+// steady state ingest: allocations and time per 1000 samples (build with COUNT_ALLOCATIONS)
+void allocationTesting(Database& database, uint32_t packSize, std::ofstream& fs)
+{
+	const uint32_t warmUpPacks = 10;
+	const uint32_t packs = 100;
+	std::vector<LogSample> samples(packSize * (warmUpPacks + packs));
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		fillRandom(samples[i].hp1);
+		fillRandom(samples[i].hp2);
+		fillRandom(samples[i].hpOut);
+	}
+
+	time_t startTime = time(NULL);
+	for (uint32_t i = 0; i < warmUpPacks; i++)
+		database.addT(startTime + i * packSize, &samples[i * packSize], packSize);
+
+	uint64_t allocations = getAllocations();
+	Timer timer(true);
+	for (uint32_t i = warmUpPacks; i < warmUpPacks + packs; i++)
+		database.addT(startTime + i * packSize, &samples[i * packSize], packSize);
+	double addTime = timer.stop();
+	allocations = getAllocations() - allocations;
+
+	double per1000 = 1000.0 / (packs * packSize);
+	fs << "pack size, allocations per 1000 samples, time per 1000 samples\n";
+	fs << packSize << ", " << allocations * per1000 << ", " << addTime * per1000 << "\n";
+#ifdef COUNT_ALLOCATIONS
+	std::cout << "INGEST: " << allocations * per1000 << " ALLOCATIONS, " << addTime * per1000 << " SEC PER 1000 SAMPLES\n";
+#else
+	std::cout << "INGEST: " << addTime * per1000 << " SEC PER 1000 SAMPLES (ALLOCATIONS NOT COUNTED)\n";
+#endif
+}
+
+bool countMatch(DataSource /*source*/, time_t /*time*/, const void* /*data*/, void* param)
+{
+	(*static_cast<uint64_t*>(param))++;
+	return true;
+}
+
+// incident query "DF > 5 ms or MLR > 0 on HP2": filtered scan against get and filter
+void scanTesting(Database& database, std::ofstream& fs)
+{
+	time_t startTime = database.getStartTime();
+	uint32_t size = database.getTotalSamples();
+	ScanFilter filter;
+	filter.delayFactorAbove = 0.005;
+	filter.mediaLossAbove = 0;
+
+	ScanStats stats;
+	uint64_t matches = 0;
+	Timer timer(true);
+	database.scan(DS_IN_HP2, startTime, startTime + size, filter, countMatch, &matches, &stats);
+	double scanTime = timer.stop();
+
+	std::vector<LogSample> samples(size);
+	uint64_t getMatches = 0;
+	timer.start();
+	size = database.get(size ? &samples[0] : NULL, size, startTime);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		if (samples[i].hp2.delayFactor > filter.delayFactorAbove || samples[i].hp2.mediaLossRate > 0)
+			getMatches++;
+	}
+	double getTime = timer.stop();
+
+	fs << "scan time, get time, matches, blocks, skipped blocks, samples read\n";
+	fs << scanTime << ", " << getTime << ", " << matches << ", " << stats.blocks << ", "
+		<< stats.blocksSkipped << ", " << stats.samplesRead << "\n";
+	std::cout << "SCAN " << scanTime << " (GET " << getTime << "), " << matches << " MATCHES"
+		<< (matches == getMatches ? "" : " MISMATCH") << ", SKIPPED " << stats.blocksSkipped << "/"
+		<< stats.blocks << " BLOCKS\n";
+}
+
+// polling readers (get of 100 seconds plus the metadata) next to the 1 Hz writer,
+// the reads per second should grow with the number of readers
+void readerTesting(Database& database, uint32_t seconds, std::ofstream& fs)
+{
+	fs << "readers, reads per second, writes\n";
+	for (uint32_t readers = 1; readers <= 8; readers *= 2)
+	{
+		std::atomic<bool> stop(false);
+		std::atomic<uint64_t> reads(0);
+		std::vector<std::thread> threads;
+		for (uint32_t i = 0; i < readers; i++)
+		{
+			threads.push_back(std::thread([&database, &stop, &reads, i]()
+			{
+				std::vector<LogSample> samples(100);
+				uint32_t step = 0;
+				while (!stop)
+				{
+					uint32_t total = database.getTotalSamples();
+					time_t startTime = database.getStartTime();
+					if (total > samples.size())
+						startTime += (step++ * 7919 + i * 104729) % (total - samples.size());
+					database.get(&samples[0], samples.size(), startTime);
+					reads++;
+				}
+			}));
+		}
+
+		uint32_t writes = 0;
+		time_t writeTime = database.getStartTime() + database.getTotalSamples();
+		Timer timer(true);
+		while (timer.getRunningTime() < seconds)
+		{
+			fillRandomToInputOutput(database, 1, writeTime + writes);
+			writes++;
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+		stop = true;
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		double elapsed = timer.stop();
+
+		fs << readers << ", " << reads / elapsed << ", " << writes << "\n";
+		std::cout << readers << " READERS: " << static_cast<uint64_t>(reads / elapsed) << " READS PER SEC, "
+			<< writes << " WRITES\n";
+	}
+}
+
+// capture threads feeding the queued ingest: producer cost per sample whatever the disk does
+void ingestTesting(uint32_t producers, uint32_t size, IngestPolicy policy, std::ofstream& fs)
+{
+	DatabaseOptions options;
+	options.ingestQueueSize = 65536;
+	options.ingestPolicy = policy;
+	Database database("ingestTest.db", true, options);
+
+	std::vector<LogSample> samples(size);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		fillRandom(samples[i].hp1);
+		fillRandom(samples[i].hp2);
+		fillRandom(samples[i].hpOut);
+	}
+
+	// every producer has its own range of time
+	time_t startTime = time(NULL);
+	std::atomic<uint64_t> enqueueNs(0);
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < producers; i++)
+	{
+		threads.push_back(std::thread([&database, &samples, &enqueueNs, startTime, size, i]()
+		{
+			Timer timer(true);
+			for (uint32_t j = 0; j < size; j++)
+				database.enqueue(startTime + static_cast<time_t>(i) * size * 2 + j, samples[j]);
+			enqueueNs += static_cast<uint64_t>(timer.stop() * 1e9 / size);
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	Timer timer(true);
+	database.flushIngest();
+	double flushTime = timer.stop();
+
+	fs << "producers, policy, enqueue ns per sample, flush time, written, dropped\n";
+	fs << producers << ", " << policy << ", " << enqueueNs / producers << ", " << flushTime << ", "
+		<< database.getIngestWritten() << ", " << database.getIngestDropped() << "\n";
+	std::cout << "ENQUEUE " << enqueueNs / producers << " NS PER SAMPLE, " << database.getIngestWritten()
+		<< " WRITTEN, " << database.getIngestDropped() << " DROPPED\n";
+}
+
+// timing of the maintenance tasks (retention, compaction, dumps, file deletion)
+void maintenanceTesting(Database& database, std::ofstream& fs)
+{
+	std::vector<TaskStats> stats = database.getMaintenanceStats();
+	fs << "task, runs, cancelled, average wait, max wait, average run, max run\n";
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		double runs = stats[i].runs ? static_cast<double>(stats[i].runs) : 1.0;
+		fs << stats[i].name << ", " << stats[i].runs << ", " << stats[i].cancelled << ", "
+			<< stats[i].totalWait / runs << ", " << stats[i].maxWait << ", " << stats[i].totalRun / runs << ", "
+			<< stats[i].maxRun << "\n";
+		std::cout << stats[i].name << ": " << stats[i].runs << " RUNS, WAIT " << stats[i].totalWait / runs
+			<< " (MAX " << stats[i].maxWait << "), RUN " << stats[i].totalRun / runs << " (MAX "
+			<< stats[i].maxRun << ")\n";
+	}
+}
+
+// the same packs written to one file and to one file per DataSource
+void shardTesting(uint32_t size, uint32_t packSize, std::ofstream& fs)
+{
+	std::vector<LogSample> samples(size);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		fillRandom(samples[i].hp1);
+		fillRandom(samples[i].hp2);
+		fillRandom(samples[i].hpOut);
+	}
+	time_t startTime = time(NULL);
+
+	Database single("shardSingle.db", true);
+	Timer timer(true);
+	for (uint32_t i = 0; i + packSize <= size; i += packSize)
+		single.addT(startTime + i, &samples[i], packSize);
+	double singleTime = timer.stop();
+
+	ShardedDatabase sharded("shardTest.db", ShardedDatabase::channelsPerDataSource(), true);
+	timer.start();
+	for (uint32_t i = 0; i + packSize <= size; i += packSize)
+		sharded.add(startTime + i, &samples[i], packSize);
+	double shardedTime = timer.stop();
+
+	fs << "shards, single file time, sharded time\n";
+	fs << sharded.getShardCount() << ", " << singleTime << ", " << shardedTime << "\n";
+	std::cout << "SINGLE FILE " << singleTime << ", " << sharded.getShardCount() << " SHARDS " << shardedTime
+		<< (sharded.verifyIntegrity() ? "" : " NOT OK") << "\n";
+}
+
+// many streams written through the queue (one transaction per commit interval)
+// against one addT call per sample
+void streamTesting(uint32_t streams, uint32_t seconds, std::ofstream& fs)
+{
+	DatabaseOptions options;
+	options.maxStreams = streams;
+	options.ingestQueueSize = 65536;
+	LogSample sample;
+	fillRandom(sample.hp1);
+	fillRandom(sample.hp2);
+	fillRandom(sample.hpOut);
+	time_t startTime = time(NULL);
+
+	Database grouped("streamGroup.db", true, options);
+	Timer timer(true);
+	for (uint32_t i = 0; i < seconds; i++)
+	{
+		for (uint32_t j = 0; j < streams; j++)
+			grouped.enqueue(j, startTime + i, sample);
+	}
+	grouped.flushIngest();
+	double groupTime = timer.stop();
+
+	Database single("streamSingle.db", true, options);
+	timer.start();
+	for (uint32_t i = 0; i < seconds; i++)
+	{
+		for (uint32_t j = 0; j < streams; j++)
+			single.addT(j, startTime + i, &sample, 1);
+	}
+	double singleTime = timer.stop();
+
+	uint32_t wrong = 0;
+	for (uint32_t j = 0; j < streams; j++)
+	{
+		if (grouped.getTotalSamples(j) != seconds || grouped.getStartTime(j) != startTime)
+			wrong++;
+	}
+	fs << "streams, seconds, group commit time, commit per sample time\n";
+	fs << streams << ", " << seconds << ", " << groupTime << ", " << singleTime << "\n";
+	std::cout << streams << " STREAMS GROUP COMMIT " << groupTime << ", COMMIT PER SAMPLE " << singleTime
+		<< (wrong ? " NOT OK" : "") << "\n";
+}
+
+// reads of the shared memory live view while the samples are written
+void liveViewTesting(uint32_t size, std::ofstream& fs)
+{
+	DatabaseOptions options;
+	options.ingestQueueSize = 65536;
+	options.liveViewName = "/databaseLiveTest";
+	Database database("liveView.db", true, options);
+	time_t startTime = time(NULL);
+
+	std::atomic<bool> stop(false);
+	uint64_t reads = 0;
+	uint64_t wrong = 0;
+	std::thread reader([&]()
+	{
+		LiveViewReader view;
+		view.open(options.liveViewName);
+		LogSample sample;
+		time_t sampleTime;
+		while (!stop)
+		{
+			reads++;
+			// the writer stores the second in the rates of the sample
+			if (view.getLatest(0, sample, sampleTime)
+				&& sample.hp1.rate != static_cast<uint32_t>(sampleTime - startTime))
+				wrong++;
+		}
+	});
+
+	LogSample sample;
+	Timer timer(true);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		sample.hp1.rate = i;
+		database.enqueue(startTime + i, sample);
+	}
+	database.flushIngest();
+	double writeTime = timer.stop();
+	stop = true;
+	reader.join();
+
+	fs << "samples, write time, live view reads, torn reads\n";
+	fs << size << ", " << writeTime << ", " << reads << ", " << wrong << "\n";
+	std::cout << "LIVE VIEW WRITE " << writeTime << ", READS " << reads << (wrong ? " NOT OK" : "") << "\n";
+}
+
+// latency of the single sample writes with the background WAL checkpoints
+void walTesting(uint32_t size, std::ofstream& fs)
+{
+	DatabaseOptions options;
+	options.wal = true;
+	Database database("walTest.db", true, options);
+	LogSample sample;
+	fillRandom(sample.hp1);
+	fillRandom(sample.hp2);
+	fillRandom(sample.hpOut);
+	time_t startTime = time(NULL);
+
+	Timer timer;
+	double maxLatency = 0;
+	double sumLatency = 0;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		timer.start();
+		database.addT(startTime + i, &sample, 1);
+		double latency = timer.stop();
+		sumLatency += latency;
+		maxLatency = std::max(maxLatency, latency);
+	}
+
+	WalStats stats = database.getWalStats();
+	fs << "samples, average latency, max latency, checkpoints, truncations, frames, max checkpoint\n";
+	fs << size << ", " << sumLatency / size << ", " << maxLatency << ", " << stats.checkpoints << ", "
+		<< stats.truncations << ", " << stats.framesCheckpointed << ", " << stats.maxDuration << "\n";
+	std::cout << "WAL MAX LATENCY " << maxLatency << ", CHECKPOINTS " << stats.checkpoints << ", WAL PAGES "
+		<< stats.walPages << "\n";
+}
+
+// retention cost past the limit: rows deleted one pack at a time against whole partitions dropped,
+// in the database file and as attached files
+void partitionTesting(uint32_t size, uint32_t partitionSeconds, std::ofstream& fs)
+{
+	fs << "partition seconds, partition files, samples, add time, retention runs, max retention\n";
+	uint32_t partitions[] = { 0, partitionSeconds, partitionSeconds };
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		DatabaseOptions options;
+		options.partitionSeconds = partitions[i];
+		options.partitionFiles = (i == 2);
+		Database database("partitionTest.db", true, options);
+		time_t startTime = time(NULL);
+		Timer timer(true);
+		for (uint32_t j = 0; j < size; j += 100)
+			fillRandomToInputOutput(database, 100, startTime + j);
+		double addTime = timer.stop();
+
+		TaskStats retention;
+		std::vector<TaskStats> stats = database.getMaintenanceStats();
+		for (size_t j = 0; j < stats.size(); j++)
+		{
+			if (stats[j].name == "retention")
+				retention = stats[j];
+		}
+		fs << partitions[i] << ", " << options.partitionFiles << ", " << size << ", " << addTime << ", " << retention.runs << ", " << retention.maxRun
+			<< "\n";
+		std::cout << "PARTITION SECONDS " << partitions[i] << (options.partitionFiles ? " FILES" : "") << ": ADD " << addTime << ", RETENTION RUNS "
+			<< retention.runs << ", MAX " << retention.maxRun << "\n";
+	}
+}
+
+// many reads in flight at once, answered by the query threads
+void asyncTesting(Database& database, uint32_t requests, uint32_t count, std::ofstream& fs)
+{
+	time_t startTime = database.getStartTime();
+	std::vector<std::future<std::vector<LogSample>>> futures;
+	Timer timer(true);
+	for (uint32_t i = 0; i < requests; i++)
+		futures.push_back(database.getAsync(startTime + i, count));
+	std::future<AggregateResult> aggregate = database.aggregateAsync(DS_IN_HP1, startTime,
+																	 startTime + database.getTotalSamples());
+	uint32_t incomplete = 0;
+	for (uint32_t i = 0; i < requests; i++)
+	{
+		if (futures[i].get().size() != count)
+			incomplete++;
+	}
+	AggregateResult result = aggregate.get();
+	double asyncTime = timer.stop();
+
+	fs << "requests, samples per request, time, aggregated seconds\n";
+	fs << requests << ", " << count << ", " << asyncTime << ", " << result.count << "\n";
+	std::cout << requests << " ASYNC GETS " << asyncTime << ", AGGREGATE " << result.count << " SECONDS"
+		<< (incomplete ? " NOT OK" : "") << "\n";
+}
+
+// upper bound of the bucket holding the given fraction of the histogram (microseconds)
+uint64_t getPercentile(const uint64_t (&histogram)[lockHistogramBuckets], uint64_t total, double fraction)
+{
+	uint64_t count = 0;
+	for (uint32_t i = 0; i < lockHistogramBuckets; i++)
+	{
+		count += histogram[i];
+		if (count >= total * fraction)
+			return uint64_t(1) << i;
+	}
+	return uint64_t(1) << lockHistogramBuckets;
+}
+
+// readers and a writer on the lock, the contention per call site
+void lockTesting(Database& database, uint32_t readers, uint32_t seconds, std::ofstream& fs)
+{
+	database.enableLockStats(true);
+	database.resetLockStats();
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < readers; i++)
+	{
+		threads.push_back(std::thread([&database, &stop, i]()
+		{
+			std::vector<LogSample> samples(100);
+			uint32_t step = 0;
+			while (!stop)
+			{
+				time_t startTime = database.getStartTime();
+				uint32_t total = database.getTotalSamples();
+				if (total > samples.size())
+					startTime += (step++ * 7919 + i * 104729) % (total - samples.size());
+				database.get(&samples[0], samples.size(), startTime);
+			}
+		}));
+	}
+	uint32_t writes = 0;
+	time_t writeTime = database.getStartTime() + database.getTotalSamples();
+	Timer timer(true);
+	while (timer.getRunningTime() < seconds)
+	{
+		fillRandomToInputOutput(database, 1, writeTime + writes);
+		writes++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	stop = true;
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	std::vector<LockSiteStats> stats = database.getLockStats();
+	database.enableLockStats(false);
+
+	fs << "site, acquisitions, contended, total wait, max wait, p99 wait (us), total hold, max hold, p99 hold (us)\n";
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		const LockSiteStats& site = stats[i];
+		uint64_t waitP99 = getPercentile(site.waitHistogram, site.acquisitions, 0.99);
+		uint64_t holdP99 = getPercentile(site.holdHistogram, site.acquisitions, 0.99);
+		fs << site.site << ", " << site.acquisitions << ", " << site.contended << ", " << site.totalWait << ", "
+			<< site.maxWait << ", " << waitP99 << ", " << site.totalHold << ", " << site.maxHold << ", " << holdP99 << "\n";
+		std::cout << site.site << ": " << site.acquisitions << " LOCKS, " << site.contended << " CONTENDED, WAIT "
+			<< site.totalWait << " (MAX " << site.maxWait << "), HOLD " << site.totalHold << " (MAX " << site.maxHold << ")\n";
+	}
+}
+
 void clearTesting(Database& database, std::ofstream& fs)
 {
+	uint32_t total = database.getTotalSamples();
 	Timer timer;
 	timer.start();
-	database.clearFake(fs);
+	database.clear();
 	double timeStamp = timer.stop();
-	fs << timeStamp << "\n";
+	fs << total << ", " << timeStamp << "\n";
+	std::cout << "CLEAR OF " << total << " SAMPLES " << timeStamp << "\n";
 }
 
 int main()
@@ -182,6 +993,8 @@ int main()
     std::string s = "test.csv";
     std::ofstream fs;
     fs.open(s);
+    countSqliteAllocations();
+    SqliteMemory::install();
     Random::initialize(); // TODO   
     uint32_t dbSize1 = 5000;
     uint32_t maxDBSize = 1209600;
@@ -213,6 +1026,7 @@ int main()
     }
     bool flag = true;
     int counter = 0;
+    std::shared_ptr<DumpJob> dumpJob;
 
     const double updateInterval = 1.0; // 1s
     double updateTime = 0;
@@ -232,6 +1046,8 @@ int main()
 
             if (counter % 5 == 0)
                 std::cout << counter << '\n';
+            if (dumpJob && !dumpJob->isFinished())
+                printDumpProgress(*dumpJob);
 
             fillRandomToInputOutput(database, 1, startTime1 + dbSize1 + counter);
             counter++;
@@ -241,8 +1057,7 @@ int main()
         if ((timeToDump <= 0) && flag)
         {
             flag = false;
-            std::thread dump_thread(dumpThreadFunc, std::ref(database));
-            dump_thread.detach();
+            dumpJob = startDumpJob(database, DUMP_COMPRESSION_AUTO);
             //break;
         }
 
@@ -251,6 +1066,12 @@ int main()
         {
             timer.stop();
             std::cout << counter << "\nEND OF LOOP\n";
+            // don't wait for a slow dump
+            if (dumpJob && !dumpJob->isFinished())
+            {
+                dumpJob->cancel();
+                dumpJob->wait();
+            }
             break;
         }
     }